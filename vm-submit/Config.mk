@@ -42,14 +42,17 @@
 # go breaking it, which we promise you will happen.
 
         MOUNTING=0 # be able to mount multiple file systems
-          GETCWD=0 # getcwd(3) syscall-like functionality
+          GETCWD=1 # getcwd(3) syscall-like functionality
         UPREEMPT=0 # userland preemption
              MTP=0 # multiple kernel threads per process
          SHADOWD=0 # shadow page cleanup
+            SWAP=0 # page anonymous memory out to disk 1 (needs NDISKS >= 2)
+            ZRAM=0 # compress anonymous pages in memory before swapping them
+        LARGEMAP=0 # minor read faults map the resident pages of a 4MB window
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT"
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT SWAP ZRAM LARGEMAP"
 # As above, but not booleans
         COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE BOCHS_INSTALL_DIR"
 
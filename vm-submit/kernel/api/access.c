@@ -1,4 +1,5 @@
 #include "globals.h"
+#include "kernel.h"
 #include "errno.h"
 
 #include "util/string.h"
@@ -8,20 +9,76 @@
 #include "mm/page.h"
 #include "mm/mm.h"
 #include "mm/kmalloc.h"
+#include "mm/pframe.h"
 
 #include "proc/proc.h"
 
 #include "vm/vmmap.h"
 
 #include "api/access.h"
+#include "api/uaccess.h"
 #include "api/syscall.h"
 
+uint32_t uaccess_nfast = 0;
+uint32_t uaccess_nslow = 0;
+
+/*
+ * Copies nbytes between kaddr and the user range at uaddr through the
+ * kernel addresses of the pages backing it, page by page, for as long
+ * as pagefault_peek finds them and the areas allow the access. Returns
+ * the number of bytes copied. Does not block.
+ */
+static size_t user_copy_fast(void *uaddr, void *kaddr, size_t nbytes, int forwrite)
+{
+	vmarea_t *vma = NULL;
+	pframe_t *pf = NULL;
+	int perm = forwrite ? PROT_WRITE : PROT_READ;
+	uint32_t addr, vfn, pgoff;
+	size_t done = 0, n;
+
+	while (done < nbytes) {
+		addr = (uint32_t)uaddr + done;
+		vfn = ADDR_TO_PN(addr);
+		if ((NULL == vma) || (vfn >= vma->vma_end)) {
+			vma = vmmap_lookup(curproc->p_vmmap, vfn);
+			if ((NULL == vma) || (perm != (perm & vma->vma_prot)))
+				break;
+		}
+		if (NULL == (pf = pagefault_peek(vma, vfn, forwrite)))
+			break;
+
+		pgoff = addr % PAGE_SIZE;
+		n = MIN(nbytes - done, PAGE_SIZE - pgoff);
+		if (forwrite)
+			memcpy((char *)pf->pf_addr + pgoff, (char *)kaddr + done, n);
+		else
+			memcpy((char *)kaddr + done, (char *)pf->pf_addr + pgoff, n);
+		done += n;
+	}
+	return done;
+}
+
 /* copy_to_user and copy_from_user are used to copy to and from the
- * user space of the current process.  They first check that the range
- * of addresses has valid mappings, then call vmmap_read/write.
+ * user space of the current process.  They copy what they can on the
+ * fast path above; the rest is checked for valid mappings and handed
+ * to vmmap_read/write, which bring the pages in.
  */
 int copy_from_user(void *kaddr, const void *uaddr, size_t nbytes)
 {
+	size_t done;
+
+	if ((uint32_t)uaddr + nbytes < (uint32_t)uaddr) {
+		return -EFAULT;
+	}
+	if (nbytes == (done = user_copy_fast((void *)uaddr, kaddr, nbytes, 0))) {
+		uaccess_nfast++;
+		return 0;
+	}
+	uaccess_nslow++;
+	uaddr = (const char *)uaddr + done;
+	kaddr = (char *)kaddr + done;
+	nbytes -= done;
+
 	if (!range_perm(curproc, uaddr, nbytes, PROT_READ)) {
 		return -EFAULT;
 	}
@@ -30,6 +87,20 @@ int copy_from_user(void *kaddr, const void *uaddr, size_t nbytes)
 
 int copy_to_user(void *uaddr, const void *kaddr, size_t nbytes)
 {
+	size_t done;
+
+	if ((uint32_t)uaddr + nbytes < (uint32_t)uaddr) {
+		return -EFAULT;
+	}
+	if (nbytes == (done = user_copy_fast(uaddr, (void *)kaddr, nbytes, 1))) {
+		uaccess_nfast++;
+		return 0;
+	}
+	uaccess_nslow++;
+	uaddr = (char *)uaddr + done;
+	kaddr = (const char *)kaddr + done;
+	nbytes -= done;
+
 	if (!range_perm(curproc, uaddr, nbytes, PROT_WRITE)) {
 		return -EFAULT;
 	}
@@ -123,21 +194,14 @@ char **user_vecdup(argvec_t *uvec)
 int addr_perm(struct proc *p, const void *vaddr, int perm)
 {
 
-	vmarea_t* vmArea;
-	uint32_t pageNo = ADDR_TO_PN(vaddr);
-	list_iterate_begin(&p->p_vmmap->vmm_list, vmArea, vmarea_t, vma_plink){
-		if((pageNo >= vmArea->vma_start) && (pageNo < vmArea->vma_end)){
-			if(perm != (vmArea->vma_prot & perm))
-				return 0;
-			else
-				return 1;
-		}
+	vmarea_t* vmArea = vmmap_lookup(p->p_vmmap, ADDR_TO_PN(vaddr));
 
-	}list_iterate_end();
-
-	/*This code is exceuted only on not finding the vmArea with specified vaddr.
-	  It is an error condition. Return 0*/
-	return 0;
+	/*Not finding the vmArea with specified vaddr is an error condition. Return 0*/
+	if(NULL == vmArea)
+		return 0;
+	if(perm != (vmArea->vma_prot & perm))
+		return 0;
+	return 1;
 }
 
 /*
@@ -0,0 +1,610 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+#include "types.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/debug.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/kthreadbuf.h"
+#include "proc/sched.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/pframe.h"
+#include "mm/mmobj.h"
+#include "mm/slab.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/vcache.h"
+#include "fs/file.h"
+#include "fs/stat.h"
+#include "fs/fdtable.h"
+
+#include "drivers/dev.h"
+
+#include "vm/vmmap.h"
+#include "vm/mmap.h"
+
+#include "api/access.h"
+#include "api/ioring.h"
+
+/*
+ * I/O submission rings.
+ *
+ * A ring is one page of a shared anonymous mapping in its process. The
+ * page is pinned, and the kernel reaches it at its kernel address, so
+ * the worker, which runs in a process of its own, can read submissions
+ * and post completions without the owner's page tables.
+ *
+ * ring_enter only records how far the submissions go and wakes ringd,
+ * which carries out a batch of entries of one ring at a time and wakes
+ * the ring's waiters once per batch. Entries work on the owner's file
+ * table and address space: files are looked up in its p_files and
+ * buffers are reached with vmmap_read and vmmap_write on its vmmap.
+ *
+ * A process has at most one ring, destroyed when the process exits or
+ * execs. do_execve is not in this tree, so the exec case is handled in
+ * sys_execve, before the old image goes, and a failed exec loses the
+ * ring too. As a backstop for any other way in (kernel_execve, or the
+ * process unmapping the page) a ring is also dropped as soon as its
+ * owner no longer maps ir_obj at ir_uaddr: ring_setup then succeeds
+ * again, and ring_enter and the worker never carry out old entries
+ * against an address space they were not queued for.
+ *
+ * There is a single worker, and it must not sleep for long: a read
+ * which waits for input (from a terminal, say) would hold up every
+ * ring, and the owner's exit, which waits for the worker to let go of
+ * its ring, until the input comes. Reads of character devices other
+ * than /dev/null and /dev/zero are therefore refused with -EAGAIN;
+ * the process does them with read(2).
+ */
+
+typedef struct ioring {
+        proc_t         *ir_proc;
+        mmobj_t        *ir_obj;       /* the shared anonymous object */
+        pframe_t       *ir_pf;        /* its page, pinned */
+        ioring_map_t   *ir_map;       /* which the kernel reaches here */
+        void           *ir_uaddr;     /* and the owner at this address */
+        uint32_t        ir_sq_head;   /* next submission to carry out */
+        uint32_t        ir_sq_limit;  /* end of what ring_enter submitted */
+        uint32_t        ir_cq_tail;
+        int             ir_busy;      /* the worker is in a batch */
+        int             ir_dying;
+        ktqueue_t       ir_waitq;
+        list_link_t     ir_link;      /* on ioring_list */
+} ioring_t;
+
+static list_t ioring_list;
+static slab_allocator_t *ioring_allocator = NULL;
+
+static proc_t *ringd = NULL;
+static kthread_t *ringd_thr = NULL;
+static ktqueue_t ringd_waitq;
+static int ringd_exiting = 0;
+
+uint32_t ioring_nenters = 0;
+uint32_t ioring_nops = 0;
+uint32_t ioring_nbatches = 0;
+
+/* Returns 1 if r's owner still maps the ring's page where it was put. */
+static int
+ioring_mapped(ioring_t *r)
+{
+        vmarea_t *vma;
+
+        if (NULL == r->ir_proc->p_vmmap)
+                return 0;
+        vma = vmmap_lookup(r->ir_proc->p_vmmap, ADDR_TO_PN(r->ir_uaddr));
+        return (NULL != vma) && (r->ir_obj == vma->vma_obj);
+}
+
+/* Frees r once the worker is done with it. */
+static void
+ioring_free(ioring_t *r)
+{
+        r->ir_dying = 1;
+        while (r->ir_busy)
+                sched_sleep_on(&r->ir_waitq);
+
+        list_remove(&r->ir_link);
+        pframe_unpin(r->ir_pf);
+        r->ir_obj->mmo_ops->put(r->ir_obj);
+        slab_obj_free(ioring_allocator, r);
+}
+
+/* Returns p's ring, dropping it first if p no longer maps it. */
+static ioring_t *
+ioring_find(proc_t *p)
+{
+        ioring_t *r;
+        list_iterate_begin(&ioring_list, r, ioring_t, ir_link) {
+                if (p != r->ir_proc)
+                        continue;
+                if (!ioring_mapped(r)) {
+                        ioring_free(r);
+                        return NULL;
+                }
+                return r;
+        } list_iterate_end();
+        return NULL;
+}
+
+/* completions the process has not consumed yet, as it tells us */
+static uint32_t
+ioring_cq_used(ioring_t *r)
+{
+        uint32_t used = r->ir_cq_tail - r->ir_map->ih_cq_head;
+        return (used > IORING_CQ_ENTRIES) ? IORING_CQ_ENTRIES : used;
+}
+
+/* Returns 1 if the worker has something to do for r. */
+static int
+ioring_has_work(ioring_t *r)
+{
+        return !r->ir_dying && (r->ir_sq_head != r->ir_sq_limit)
+               && (ioring_cq_used(r) < IORING_CQ_ENTRIES);
+}
+
+/*
+ * Gives the calling process a ring: maps a page of shared anonymous
+ * memory, pins it and returns its user address in *uaddrp. Returns 0,
+ * -EBUSY if the process already has a ring, or -errno.
+ */
+int
+ioring_setup(void **uaddrp)
+{
+        ioring_t *r;
+        vmarea_t *vma;
+        pframe_t *pf;
+        void *addr;
+        int ret;
+
+        if (NULL != ioring_find(curproc))
+                return -EBUSY;
+        if (NULL == (r = slab_obj_alloc(ioring_allocator)))
+                return -ENOMEM;
+
+        ret = do_mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANON, -1, 0, &addr);
+        if (0 > ret) {
+                slab_obj_free(ioring_allocator, r);
+                return ret;
+        }
+        vma = vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(addr));
+        KASSERT(NULL != vma);
+        ret = pframe_get(vma->vma_obj, vma->vma_off + ADDR_TO_PN(addr) - vma->vma_start, &pf);
+        if (0 > ret) {
+                do_munmap(addr, PAGE_SIZE);
+                slab_obj_free(ioring_allocator, r);
+                return ret;
+        }
+        pframe_pin(pf);
+        memset(pf->pf_addr, 0, PAGE_SIZE);
+
+        r->ir_proc = curproc;
+        r->ir_obj = vma->vma_obj;
+        r->ir_obj->mmo_ops->ref(r->ir_obj);
+        r->ir_pf = pf;
+        r->ir_map = (ioring_map_t *)pf->pf_addr;
+        r->ir_uaddr = addr;
+        r->ir_sq_head = 0;
+        r->ir_sq_limit = 0;
+        r->ir_cq_tail = 0;
+        r->ir_busy = 0;
+        r->ir_dying = 0;
+        sched_queue_init(&r->ir_waitq);
+        list_insert_tail(&ioring_list, &r->ir_link);
+
+        *uaddrp = addr;
+        return 0;
+}
+
+/*
+ * Submits up to to_submit of the entries the calling process queued,
+ * then waits until at least min_complete completions are there to be
+ * consumed (fewer if fewer can ever come). Returns the number of
+ * entries submitted, or -errno.
+ */
+int
+ioring_enter(uint32_t to_submit, uint32_t min_complete)
+{
+        ioring_t *r;
+        uint32_t queued, room;
+
+        if (NULL == (r = ioring_find(curproc)))
+                return -EINVAL;
+        ioring_nenters++;
+
+        queued = r->ir_map->ih_sq_tail - r->ir_sq_limit;
+        room = IORING_SQ_ENTRIES - (r->ir_sq_limit - r->ir_sq_head);
+        to_submit = MIN(to_submit, MIN(queued, room));
+        if (0 < to_submit) {
+                r->ir_sq_limit += to_submit;
+                sched_broadcast_on(&ringd_waitq);
+        }
+
+        while (ioring_cq_used(r) < min_complete) {
+                if (!r->ir_busy && (!ioring_has_work(r) || !ioring_mapped(r)))
+                        break;
+                if (sched_cancellable_sleep_on(&r->ir_waitq))
+                        return -EINTR;
+        }
+        return to_submit;
+}
+
+/*
+ * Takes away p's ring, if it has one, once the worker is done with it.
+ * Called by p itself on exit and exec, before its files and address
+ * space go.
+ */
+void
+ioring_destroy(proc_t *p)
+{
+        ioring_t *r;
+
+        list_iterate_begin(&ioring_list, r, ioring_t, ir_link) {
+                if (p == r->ir_proc) {
+                        ioring_free(r);
+                        return;
+                }
+        } list_iterate_end();
+}
+
+/*
+ * Looks up fd in p's table for an entry, checking mode as do_read and
+ * do_write would (no check for a mode of 0). Returns the file with a
+ * reference held, or NULL with *errp set.
+ */
+static file_t *
+ioring_fget(proc_t *p, int fd, int mode, int *errp)
+{
+        file_t *f;
+
+        if ((0 > fd) || (NFILES <= fd) || (NULL == (f = p->p_files[fd]))) {
+                *errp = -EBADF;
+                return NULL;
+        }
+        if (mode && !(mode & f->f_mode)) {
+                *errp = -EBADF;
+                return NULL;
+        }
+        if (mode && S_ISDIR(f->f_vnode->vn_mode)) {
+                *errp = -EISDIR;
+                return NULL;
+        }
+        fref(f);
+        return f;
+}
+
+/*
+ * Reads a read entry's file into the owner's buffer, from the page
+ * cache for regular files, through the worker's bounce page otherwise.
+ */
+static int
+ioring_read(ioring_t *r, ioring_sqe_t *sqe)
+{
+        proc_t *p = r->ir_proc;
+        file_t *f;
+        vnode_t *vn;
+        pframe_t *pf;
+        void *bounce;
+        char *buf = sqe->sqe_buf;
+        size_t done = 0;
+        uint32_t pgoff, n;
+        off_t pos;
+        int ret = 0;
+
+        if (!range_perm(p, buf, sqe->sqe_len, PROT_WRITE))
+                return -EFAULT;
+        if (NULL == (f = ioring_fget(p, sqe->sqe_fd, FMODE_READ, &ret)))
+                return ret;
+        vn = f->f_vnode;
+        if ((-1 != sqe->sqe_off) && S_ISCHR(vn->vn_mode)) {
+                fput(f);
+                return -ESPIPE;
+        }
+        /* may wait for input indefinitely; see the top of this file */
+        if (S_ISCHR(vn->vn_mode) && (MEM_NULL_DEVID != vn->vn_devid)
+            && (MEM_ZERO_DEVID != vn->vn_devid)) {
+                fput(f);
+                return -EAGAIN;
+        }
+        pos = (-1 == sqe->sqe_off) ? f->f_pos : sqe->sqe_off;
+
+        if (S_ISREG(vn->vn_mode) && (NULL != vn->vn_ops->fillpage)) {
+                while (done < sqe->sqe_len) {
+                        pgoff = pos % PAGE_SIZE;
+                        if (0 >= (ret = vnode_pin_page(vn, pos, sqe->sqe_len - done, &pf)))
+                                break;
+                        n = ret;
+                        ret = vmmap_write(p->p_vmmap, buf + done, (char *)pf->pf_addr + pgoff, n);
+                        pframe_unpin(pf);
+                        if (0 > ret)
+                                break;
+                        done += n;
+                        pos += n;
+                }
+        } else if (NULL != (bounce = kthread_bounce_page(curthr))) {
+                do {
+                        n = MIN(sqe->sqe_len - done, PAGE_SIZE);
+                        if (0 >= (ret = vn->vn_ops->read(vn, pos, bounce, n)))
+                                break;
+                        if (0 > vmmap_write(p->p_vmmap, buf + done, bounce, ret)) {
+                                ret = -EFAULT;
+                                break;
+                        }
+                        done += ret;
+                        pos += ret;
+                } while (!S_ISCHR(vn->vn_mode) && ((uint32_t)ret == n) && (done < sqe->sqe_len));
+        } else {
+                ret = -ENOMEM;
+        }
+
+        if (-1 == sqe->sqe_off)
+                f->f_pos = pos;
+        fput(f);
+        return (0 < done) ? (int)done : ret;
+}
+
+/*
+ * Writes the owner's buffer to a write entry's file a page at a time
+ * through the worker's bounce page, stopping at the first short write.
+ */
+static int
+ioring_write(ioring_t *r, ioring_sqe_t *sqe)
+{
+        proc_t *p = r->ir_proc;
+        file_t *f;
+        vnode_t *vn;
+        void *bounce;
+        const char *buf = sqe->sqe_buf;
+        size_t done = 0;
+        uint32_t n;
+        off_t pos;
+        int ret = 0;
+
+        if (!range_perm(p, buf, sqe->sqe_len, PROT_READ))
+                return -EFAULT;
+        if (NULL == (f = ioring_fget(p, sqe->sqe_fd, FMODE_WRITE, &ret)))
+                return ret;
+        vn = f->f_vnode;
+        if ((-1 != sqe->sqe_off) && S_ISCHR(vn->vn_mode)) {
+                fput(f);
+                return -ESPIPE;
+        }
+        if (NULL == (bounce = kthread_bounce_page(curthr))) {
+                fput(f);
+                return -ENOMEM;
+        }
+        if (-1 == sqe->sqe_off)
+                pos = (FMODE_APPEND & f->f_mode) ? vn->vn_len : f->f_pos;
+        else
+                pos = sqe->sqe_off;
+
+        while (done < sqe->sqe_len) {
+                n = MIN(sqe->sqe_len - done, PAGE_SIZE);
+                if (0 > (ret = vmmap_read(p->p_vmmap, buf + done, bounce, n)))
+                        break;
+                if (0 >= (ret = vn->vn_ops->write(vn, pos, bounce, n)))
+                        break;
+                done += ret;
+                pos += ret;
+                if ((uint32_t)ret < n)
+                        break;
+        }
+
+        if (-1 == sqe->sqe_off)
+                f->f_pos = pos;
+        fput(f);
+        return (0 < done) ? (int)done : ret;
+}
+
+/*
+ * Copies the path of an open entry into the worker's bounce page, a
+ * page of the owner's address space at a time.
+ */
+static int
+ioring_getpath(ioring_t *r, const char *upath, char **pathp)
+{
+        char *path;
+        size_t done = 0, n, i;
+        int ret;
+
+        if (NULL == (path = kthread_bounce_page(curthr)))
+                return -ENOMEM;
+        while (done < MAXPATHLEN) {
+                n = PAGE_SIZE - ((uint32_t)(upath + done) % PAGE_SIZE);
+                n = MIN(n, MAXPATHLEN - done);
+                if (!range_perm(r->ir_proc, upath + done, n, PROT_READ))
+                        return -EFAULT;
+                if (0 > (ret = vmmap_read(r->ir_proc->p_vmmap, upath + done, path + done, n)))
+                        return ret;
+                for (i = done; i < done + n; ++i) {
+                        if ('\0' == path[i]) {
+                                *pathp = path;
+                                return 0;
+                        }
+                }
+                done += n;
+        }
+        return -ENAMETOOLONG;
+}
+
+/* Writes the dirty resident pages of vn back; see pframe_clean_all. */
+static int
+ioring_fsync(vnode_t *vn)
+{
+        pframe_t *pf;
+        int ret;
+
+again:
+        list_iterate_begin(&vn->vn_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        goto again;
+                }
+                if (pframe_is_dirty(pf) && !pframe_is_pinned(pf)) {
+                        if (0 > (ret = pframe_clean(pf)))
+                                return ret;
+                        goto again;
+                }
+        } list_iterate_end();
+        return 0;
+}
+
+/* Carries out one entry and returns its result. */
+static int
+ioring_op(ioring_t *r, ioring_sqe_t *sqe)
+{
+        proc_t *p = r->ir_proc;
+        file_t *f;
+        char *path;
+        int ret = 0;
+
+        switch (sqe->sqe_op) {
+        case IORING_OP_READ:
+                return ioring_read(r, sqe);
+
+        case IORING_OP_WRITE:
+                return ioring_write(r, sqe);
+
+        case IORING_OP_OPEN:
+                if (0 > (ret = ioring_getpath(r, sqe->sqe_buf, &path)))
+                        return ret;
+                return do_open_in(p, path, (int)sqe->sqe_len);
+
+        case IORING_OP_CLOSE:
+                if ((0 > sqe->sqe_fd) || (NFILES <= sqe->sqe_fd)
+                    || (NULL == p->p_files[sqe->sqe_fd]))
+                        return -EBADF;
+                fput(fd_clear(p, sqe->sqe_fd));
+                return 0;
+
+        case IORING_OP_FSYNC:
+                if (NULL == (f = ioring_fget(p, sqe->sqe_fd, 0, &ret)))
+                        return ret;
+                ret = ioring_fsync(f->f_vnode);
+                fput(f);
+                return ret;
+
+        default:
+                return -EINVAL;
+        }
+}
+
+/*
+ * Carries out up to IORING_BATCH submitted entries of r, as long as
+ * there is room for their completions, then wakes whoever waits on r.
+ */
+static void
+ioring_run(ioring_t *r)
+{
+        ioring_sqe_t sqe;
+        ioring_cqe_t *cqe;
+        int n = 0;
+
+        r->ir_busy = 1;
+        while ((n < IORING_BATCH) && ioring_has_work(r) && ioring_mapped(r)) {
+                /* the entry is the process's to change; work on a copy */
+                sqe = r->ir_map->ih_sq[r->ir_sq_head % IORING_SQ_ENTRIES];
+                r->ir_sq_head++;
+                r->ir_map->ih_sq_head = r->ir_sq_head;
+
+                cqe = &r->ir_map->ih_cq[r->ir_cq_tail % IORING_CQ_ENTRIES];
+                cqe->cqe_res = ioring_op(r, &sqe);
+                cqe->cqe_data = sqe.sqe_data;
+                r->ir_cq_tail++;
+                r->ir_map->ih_cq_tail = r->ir_cq_tail;
+                n++;
+        }
+        r->ir_busy = 0;
+
+        ioring_nops += n;
+        ioring_nbatches++;
+        sched_broadcast_on(&r->ir_waitq);
+}
+
+static void *
+ringd_run(int arg1, void *arg2)
+{
+        ioring_t *r, *next;
+
+        while (!ringd_exiting) {
+                next = NULL;
+                list_iterate_begin(&ioring_list, r, ioring_t, ir_link) {
+                        /* a ring its owner dropped waits for ioring_find */
+                        if (ioring_has_work(r) && ioring_mapped(r)) {
+                                next = r;
+                                break;
+                        }
+                } list_iterate_end();
+                if (NULL == next) {
+                        sched_sleep_on(&ringd_waitq);
+                        continue;
+                }
+
+                /* round robin: the ring goes to the back of the list */
+                list_remove(&next->ir_link);
+                list_insert_tail(&ioring_list, &next->ir_link);
+                ioring_run(next);
+        }
+        kthread_exit((void *)0);
+        return NULL;
+}
+
+static __attribute__((unused)) void
+ioring_init(void)
+{
+        KASSERT(sizeof(ioring_map_t) <= PAGE_SIZE);
+
+        list_init(&ioring_list);
+        ioring_allocator = slab_allocator_create("ioring", sizeof(ioring_t));
+        KASSERT(NULL != ioring_allocator);
+        sched_queue_init(&ringd_waitq);
+}
+init_func(ioring_init);
+
+static __attribute__((unused)) void
+ringd_init(void)
+{
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        ringd = proc_create("ringd");
+        KASSERT(NULL != ringd);
+        ringd_thr = kthread_create(ringd, ringd_run, 0, NULL);
+        KASSERT(NULL != ringd_thr);
+
+        sched_make_runnable(ringd_thr);
+}
+init_func(ringd_init);
+init_depends(sched_init);
+
+/*
+ * Stops ringd and waits for it. Called by the idle process once every
+ * other process, and so every ring, is gone.
+ */
+void
+ioring_shutdown(void)
+{
+        int pid, child;
+
+        KASSERT(PID_IDLE == curproc->p_pid);
+        KASSERT(NULL != ringd);
+        KASSERT(list_empty(&ioring_list));
+
+        pid = ringd->p_pid;
+        ringd_exiting = 1;
+        sched_broadcast_on(&ringd_waitq);
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than ringd");
+        ringd = NULL;
+        ringd_thr = NULL;
+}
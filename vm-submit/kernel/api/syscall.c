@@ -7,6 +7,7 @@
 
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/kthreadbuf.h"
 
 #include "util/init.h"
 #include "util/string.h"
@@ -20,18 +21,26 @@
 #include "mm/kmalloc.h"
 
 #include "fs/vfs_syscall.h"
+#include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/file.h"
+#include "fs/stat.h"
+#include "fs/vcache.h"
 
 #include "test/kshell/kshell.h"
 
 #include "vm/brk.h"
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/madvise.h"
+#include "vm/mremap.h"
 
 #include "api/syscall.h"
 #include "api/utsname.h"
 #include "api/access.h"
 #include "api/exec.h"
+#include "api/syscallext.h"
+#include "api/ioring.h"
 
 static void syscall_handler(regs_t *regs);
 static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs);
@@ -43,141 +52,625 @@ static __attribute__((unused)) void syscall_init(void)
 init_func(syscall_init);
 
 /*
- * this is one of the few sys_* functions you have to write. be sure to
- * check out the sys_* functions we have provided before trying to write
- * this one.
- *  - copy_from_user() the read_args_t
- *  - page_alloc() a temporary buffer
- *  - call do_read(), and copy_to_user() the read bytes
- *  - page_free() your buffer
- *  - return the number of bytes actually read, or if anything goes wrong
- *    set curthr->kt_errno and return -1
+ * Reads up to nbytes at *posp of f, a regular file, by copying straight
+ * from its page cache pages into the user buffer. Each page is pinned
+ * by vnode_pin_page while it is copied, since copy_to_user may block
+ * bringing in the user page. Returns the number of bytes read, or
+ * -errno if nothing could be read.
+ */
+static int
+file_read_pages(file_t *f, off_t *posp, void *ubuf, size_t nbytes)
+{
+  vnode_t* vn = f->f_vnode;
+  pframe_t* pf = NULL;
+  size_t done = 0;
+  uint32_t pgoff = 0, n = 0;
+  int Val = 0;
+
+  while(done < nbytes)
+    {
+      pgoff = *posp % PAGE_SIZE;
+      if(0 >= (Val = vnode_pin_page(vn, *posp, nbytes - done, &pf)))
+        break;
+      n = Val;
+      Val = copy_to_user((char *)ubuf + done, (char *)pf->pf_addr + pgoff, n);
+      pframe_unpin(pf);
+      if(0 > Val)
+        break;
+
+      done += n;
+      *posp += n;
+    }
+  return (0 < done) ? (int)done : Val;
+}
+
+/*
+ * Reads up to nbytes at *posp of f into user memory, advancing *posp,
+ * without a kernel buffer the size of the request. Regular files are
+ * copied from their page cache pages directly; everything else is read
+ * a page at a time through the thread's bounce page, only as many bytes
+ * as each read returned being copied out. A character device gets a
+ * single read, since another one would block waiting for input the
+ * caller may not want. f must be open for reading and not a directory.
+ * Returns the number of bytes read, or -errno if nothing was.
+ */
+static int
+file_read_user(file_t *f, off_t *posp, void *ubuf, size_t nbytes)
+{
+  vnode_t* vn = f->f_vnode;
+  void* bounce = NULL;
+  size_t done = 0, n = 0;
+  int Val = 0;
+
+  if(S_ISREG(vn->vn_mode) && (NULL != vn->vn_ops->fillpage))
+    return file_read_pages(f, posp, ubuf, nbytes);
+
+  if(NULL == (bounce = kthread_bounce_page(curthr)))
+    return -ENOMEM;
+  do
+    {
+      n = MIN(nbytes - done, PAGE_SIZE);
+      if(0 >= (Val = vn->vn_ops->read(vn, *posp, bounce, n)))
+        break;
+      if(0 > copy_to_user((char *)ubuf + done, bounce, Val))
+        {
+          Val = -EFAULT;
+          break;
+        }
+      done += Val;
+      *posp += Val;
+    } while(!S_ISCHR(vn->vn_mode) && ((size_t)Val == n) && (done < nbytes));
+
+  return (0 < done) ? (int)done : Val;
+}
+
+/*
+ * Writes nbytes of user memory at *posp of f a page at a time through
+ * the thread's bounce page, advancing *posp and stopping at the first
+ * short write. f must be open for writing. Returns the number of bytes
+ * written, or -errno if nothing was.
+ */
+static int
+file_write_user(file_t *f, off_t *posp, const void *ubuf, size_t nbytes)
+{
+  vnode_t* vn = f->f_vnode;
+  void* bounce = NULL;
+  size_t done = 0, n = 0;
+  int Val = 0;
+
+  if(NULL == (bounce = kthread_bounce_page(curthr)))
+    return -ENOMEM;
+  do
+    {
+      n = MIN(nbytes - done, PAGE_SIZE);
+      if(0 > (Val = copy_from_user(bounce, (const char *)ubuf + done, n)))
+        break;
+      if(0 >= (Val = vn->vn_ops->write(vn, *posp, bounce, n)))
+        break;
+      done += Val;
+      *posp += Val;
+    } while(((size_t)Val == n) && (done < nbytes));
+
+  return (0 < done) ? (int)done : Val;
+}
+
+/*
+ * Looks up fd for a read or write (FMODE_READ or FMODE_WRITE in mode),
+ * making the checks do_read and do_write make. Returns the file with a
+ * reference held, or NULL with *errp set.
+ */
+static file_t *
+file_get_rw(int fd, int mode, int *errp)
+{
+  file_t* f = NULL;
+
+  if((0 > fd) || (NFILES <= fd) || (NULL == (f = fget(fd))))
+    {
+      *errp = -EBADF;
+      return NULL;
+    }
+  if(!(mode & f->f_mode))
+    {
+      fput(f);
+      *errp = -EBADF;
+      return NULL;
+    }
+  if(S_ISDIR(f->f_vnode->vn_mode))
+    {
+      fput(f);
+      *errp = -EISDIR;
+      return NULL;
+    }
+  return f;
+}
+
+/*
+ * Reads nbytes from fd at its file position into user memory; see
+ * file_read_user. Returns the number of bytes read, or -1 with
+ * curthr->kt_errno set.
  */
 static int
 sys_read(read_args_t *arg)
 {
-	int Val =0;
   read_args_t readArg_t;
+  file_t* f = NULL;
+  int Val = 0;
 
-		
   if (0 > copy_from_user(&readArg_t, arg, sizeof(readArg_t)))
   {
     curthr->kt_errno = EFAULT;
     return -1;
   }
-  void* tempMem = kmalloc(readArg_t.nbytes);
-  if(!tempMem)
-    {
-      curthr->kt_errno = ENOMEM;
-      return -1;
-    }
-   Val = do_read(readArg_t.fd, tempMem, readArg_t.nbytes);
-  copy_to_user(arg->buf, tempMem, readArg_t.nbytes);
-  kfree(tempMem);
-       
-  if (0 > Val) {
+  if (NULL == (f = file_get_rw(readArg_t.fd, FMODE_READ, &Val))) {
     curthr->kt_errno = -Val;
     return -1;
   }
 
+  Val = file_read_user(f, &f->f_pos, readArg_t.buf, readArg_t.nbytes);
+  fput(f);
+  if (0 > Val) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
   return Val;
 }
 
 /*
- * This function is almost identical to sys_read.  See comments above.
+ * Writes nbytes of user memory to fd at its file position (at its end
+ * if it was opened for appending); see file_write_user. Returns the
+ * number of bytes written, or -1 with curthr->kt_errno set.
  */
 static int
 sys_write(write_args_t *arg)
 {
-	int Val =0;
   write_args_t writeArg_t;
+  file_t* f = NULL;
+  int Val = 0;
 
-
-		
   if (copy_from_user(&writeArg_t, arg, sizeof(writeArg_t)) < 0) {
     curthr->kt_errno = EFAULT;
     return -1;
   }
-  void* tempMem = tempMem = kmalloc(writeArg_t.nbytes);
-  if(!tempMem)
+  if (NULL == (f = file_get_rw(writeArg_t.fd, FMODE_WRITE, &Val))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+
+  if(FMODE_APPEND & f->f_mode)
+    f->f_pos = f->f_vnode->vn_len;
+  Val = file_write_user(f, &f->f_pos, writeArg_t.buf, writeArg_t.nbytes);
+  fput(f);
+  if (0 > Val) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  return Val;
+}
+
+/*
+ * readv and writev: one fget and one permission check for the whole
+ * vector, then the segments in order at the file position, stopping at
+ * the first one which is not transferred in full. Returns the total
+ * number of bytes transferred, or -1 with curthr->kt_errno set if no
+ * bytes were. The lengths may add up to at most RWV_MAX, so that the
+ * total fits the int returned (EINVAL otherwise, as in Linux).
+ */
+#define RWV_MAX 0x7fffffff
+
+static int
+sys_rwv(rwv_args_t *arg, int mode)
+{
+  rwv_args_t kargs;
+  struct iovec iov[UIO_MAXIOV];
+  file_t* f = NULL;
+  size_t total = 0;
+  int i = 0, Val = 0;
+
+  if (0 > copy_from_user(&kargs, arg, sizeof(kargs))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if ((0 > kargs.rwv_iovcnt) || (UIO_MAXIOV < kargs.rwv_iovcnt)) {
+    curthr->kt_errno = EINVAL;
+    return -1;
+  }
+  if (0 > copy_from_user(iov, kargs.rwv_iov, kargs.rwv_iovcnt * sizeof(struct iovec))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  for (i = 0; i < kargs.rwv_iovcnt; i++) {
+    if (iov[i].iov_len > RWV_MAX - total) {
+      curthr->kt_errno = EINVAL;
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+  if (NULL == (f = file_get_rw(kargs.rwv_fd, mode, &Val))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+
+  if ((FMODE_WRITE == mode) && (FMODE_APPEND & f->f_mode))
+    f->f_pos = f->f_vnode->vn_len;
+  total = 0;
+  for (i = 0; i < kargs.rwv_iovcnt; i++) {
+    if (0 == iov[i].iov_len)
+      continue;
+    if (FMODE_READ == mode)
+      Val = file_read_user(f, &f->f_pos, iov[i].iov_base, iov[i].iov_len);
+    else
+      Val = file_write_user(f, &f->f_pos, iov[i].iov_base, iov[i].iov_len);
+    if (0 > Val)
+      break;
+    total += Val;
+    if ((size_t)Val < iov[i].iov_len)
+      break;
+  }
+  fput(f);
+
+  if ((0 == total) && (0 > Val)) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  return total;
+}
+
+/*
+ * pread and pwrite: like read and write at the given offset, leaving
+ * the file position alone (pwrite ignores O_APPEND). Files without a
+ * position, character devices, fail with ESPIPE.
+ */
+static int
+sys_prw(prw_args_t *arg, int mode)
+{
+  prw_args_t kargs;
+  file_t* f = NULL;
+  off_t pos = 0;
+  int Val = 0;
+
+  if (0 > copy_from_user(&kargs, arg, sizeof(kargs))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if (0 > kargs.prw_offset) {
+    curthr->kt_errno = EINVAL;
+    return -1;
+  }
+  if (NULL == (f = file_get_rw(kargs.prw_fd, mode, &Val))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  if (S_ISCHR(f->f_vnode->vn_mode)) {
+    fput(f);
+    curthr->kt_errno = ESPIPE;
+    return -1;
+  }
+
+  pos = kargs.prw_offset;
+  if (FMODE_READ == mode)
+    Val = file_read_user(f, &pos, kargs.prw_buf, kargs.prw_nbytes);
+  else
+    Val = file_write_user(f, &pos, kargs.prw_buf, kargs.prw_nbytes);
+  fput(f);
+  if (0 > Val) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  return Val;
+}
+
+/*
+ * Copies up to nbytes at *inposp of in to *outposp of out without going
+ * through user memory, advancing both positions and stopping at the end
+ * of in or at the first short write. A regular file is written out
+ * straight from its page cache pages, each pinned by vnode_pin_page
+ * meanwhile, so every byte is copied once: by out's write into its own
+ * page cache page when out is a regular file, or to the device. The
+ * write is made without in's lock held, since out may be in itself.
+ * Other sources are read a page at a time into the thread's bounce
+ * page; a character device gets a single read, as in file_read_user.
+ * Copying a range of a file onto an overlapping range of itself fails
+ * with EINVAL. Returns the number of bytes copied, or -errno if
+ * nothing was.
+ */
+static int
+file_copy(file_t *in, off_t *inposp, file_t *out, off_t *outposp, size_t nbytes)
+{
+  vnode_t* ivn = in->f_vnode;
+  vnode_t* ovn = out->f_vnode;
+  pframe_t* pf = NULL;
+  void* bounce = NULL;
+  size_t done = 0;
+  uint32_t pgoff = 0, n = 0;
+  int Val = 0, cached = 0;
+
+  if((ivn == ovn) && ((size_t)(*inposp - *outposp) < nbytes
+                      || (size_t)(*outposp - *inposp) < nbytes))
+    return -EINVAL;
+
+  cached = S_ISREG(ivn->vn_mode) && (NULL != ivn->vn_ops->fillpage);
+  if(!cached && (NULL == (bounce = kthread_bounce_page(curthr))))
+    return -ENOMEM;
+
+  while(done < nbytes)
     {
-      curthr->kt_errno = ENOMEM;
-      return NULL;
+      if(cached)
+        {
+          pgoff = *inposp % PAGE_SIZE;
+          if(0 >= (Val = vnode_pin_page(ivn, *inposp, nbytes - done, &pf)))
+            break;
+          n = Val;
+          Val = ovn->vn_ops->write(ovn, *outposp, (char *)pf->pf_addr + pgoff, n);
+          pframe_unpin(pf);
+        }
+      else
+        {
+          n = MIN(nbytes - done, PAGE_SIZE);
+          if(0 >= (Val = ivn->vn_ops->read(ivn, *inposp, bounce, n)))
+            break;
+          n = Val;
+          Val = ovn->vn_ops->write(ovn, *outposp, bounce, n);
+        }
+      if(0 >= Val)
+        break;
+      done += Val;
+      *inposp += Val;
+      *outposp += Val;
+      if(((size_t)Val < n) || S_ISCHR(ivn->vn_mode))
+        break;
     }
-		
-  copy_from_user( tempMem, arg->buf, writeArg_t.nbytes);
-		
-  Val = do_write(writeArg_t.fd, tempMem, writeArg_t.nbytes);
-  kfree(tempMem);
-       
+  return (0 < done) ? (int)done : Val;
+}
+
+/*
+ * Copies count bytes from in_fd to out_fd at out_fd's position, in the
+ * kernel; see file_copy. in_fd is read at *offset, which is updated,
+ * or at its own position if offset is NULL. Returns the number of bytes
+ * copied, or -1 with curthr->kt_errno set.
+ */
+static int
+sys_sendfile(sendfile_args_t *arg)
+{
+  sendfile_args_t kargs;
+  file_t* in = NULL;
+  file_t* out = NULL;
+  off_t pos = 0;
+  int Val = 0;
+
+  if (0 > copy_from_user(&kargs, arg, sizeof(kargs))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if ((NULL != kargs.sf_offset)
+      && (0 > copy_from_user(&pos, kargs.sf_offset, sizeof(pos)))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if ((NULL != kargs.sf_offset) && (0 > pos)) {
+    curthr->kt_errno = EINVAL;
+    return -1;
+  }
+  if (NULL == (in = file_get_rw(kargs.sf_infd, FMODE_READ, &Val))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  if (NULL == (out = file_get_rw(kargs.sf_outfd, FMODE_WRITE, &Val))) {
+    fput(in);
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+
+  if (FMODE_APPEND & out->f_mode)
+    out->f_pos = out->f_vnode->vn_len;
+  if (NULL == kargs.sf_offset)
+    pos = in->f_pos;
+  Val = file_copy(in, &pos, out, &out->f_pos, kargs.sf_count);
+  if (NULL == kargs.sf_offset)
+    in->f_pos = pos;
+  fput(out);
+  fput(in);
   if (0 > Val) {
     curthr->kt_errno = -Val;
+    return -1;
+  }
+  if ((NULL != kargs.sf_offset)
+      && (0 > copy_to_user(kargs.sf_offset, &pos, sizeof(pos)))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  return Val;
+}
 
+/*
+ * Copies len bytes between two regular files, page cache to page cache;
+ * see file_copy. Each side is at *off, which is updated, or at the
+ * file's own position if its offset pointer is NULL. Returns the number
+ * of bytes copied, or -1 with curthr->kt_errno set.
+ */
+static int
+sys_copy_file_range(cfr_args_t *arg)
+{
+  cfr_args_t kargs;
+  file_t* in = NULL;
+  file_t* out = NULL;
+  off_t inpos = 0, outpos = 0;
+  int Val = 0;
+
+  if (0 > copy_from_user(&kargs, arg, sizeof(kargs))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if (0 != kargs.cfr_flags) {
+    curthr->kt_errno = EINVAL;
+    return -1;
+  }
+  if (((NULL != kargs.cfr_inoff)
+       && (0 > copy_from_user(&inpos, kargs.cfr_inoff, sizeof(inpos))))
+      || ((NULL != kargs.cfr_outoff)
+          && (0 > copy_from_user(&outpos, kargs.cfr_outoff, sizeof(outpos))))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if ((0 > inpos) || (0 > outpos)) {
+    curthr->kt_errno = EINVAL;
+    return -1;
+  }
+  if (NULL == (in = file_get_rw(kargs.cfr_infd, FMODE_READ, &Val))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  if (NULL == (out = file_get_rw(kargs.cfr_outfd, FMODE_WRITE, &Val))) {
+    fput(in);
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  if (!S_ISREG(in->f_vnode->vn_mode) || !S_ISREG(out->f_vnode->vn_mode)) {
+    fput(out);
+    fput(in);
+    curthr->kt_errno = EINVAL;
     return -1;
   }
 
+  if (NULL == kargs.cfr_inoff)
+    inpos = in->f_pos;
+  if (NULL == kargs.cfr_outoff)
+    outpos = out->f_pos;
+  Val = file_copy(in, &inpos, out, &outpos, kargs.cfr_len);
+  if (NULL == kargs.cfr_inoff)
+    in->f_pos = inpos;
+  if (NULL == kargs.cfr_outoff)
+    out->f_pos = outpos;
+  fput(out);
+  fput(in);
+  if (0 > Val) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  if (((NULL != kargs.cfr_inoff)
+       && (0 > copy_to_user(kargs.cfr_inoff, &inpos, sizeof(inpos))))
+      || ((NULL != kargs.cfr_outoff)
+          && (0 > copy_to_user(kargs.cfr_outoff, &outpos, sizeof(outpos))))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
   return Val;
 }
 
 /*
- * This is another tricly sys_* function that you will need to write.
- * It's pretty similar to sys_read(), but you don't need
- * to allocate a whole page, just a single dirent_t. call do_getdents in a
- * loop until you have read getdent_args_t->count bytes (or an error
- * occurs).  You should note that count is the number of bytes in the
- * buffer, not the number of dirents, which means that you'll need to loop
- * a max of something like count / sizeof(dirent_t) times.
+ * Gives the process an I/O submission ring; see api/ioring.c. Returns
+ * the user address of the ring page, or -1 with curthr->kt_errno set.
  */
 static int
-sys_getdents(getdents_args_t *arg)
+sys_ring_setup(void)
 {
-	uint32_t bCount = 0;
-	getdents_args_t getdents_params;
-	int val = 0;
+  void* addr = NULL;
+  int Val = 0;
 
+  if (0 > (Val = ioring_setup(&addr))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  return (int)addr;
+}
 
+/*
+ * Submits queued ring entries and waits for completions; one trap for
+ * a whole batch of reads, writes, opens, closes and fsyncs. Returns the
+ * number of entries submitted, or -1 with curthr->kt_errno set.
+ */
+static int
+sys_ring_enter(ring_enter_args_t *arg)
+{
+  ring_enter_args_t kargs;
+  int Val = 0;
+
+  if (0 > copy_from_user(&kargs, arg, sizeof(kargs))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+  if (0 > (Val = ioring_enter(kargs.re_to_submit, kargs.re_min_complete))) {
+    curthr->kt_errno = -Val;
+    return -1;
+  }
+  return Val;
+}
+
+/*
+ * Reads as many directory entries as fit in count bytes of the user
+ * buffer. Entries are gathered a page worth at a time into the
+ * thread's bounce page, each with a call to the directory's readdir at
+ * a position local to this call, and every batch is copied out with a
+ * single copy_to_user. f_pos, the readdir offset at which the next call
+ * resumes, only moves past entries which reached the user, so a failed
+ * copy loses none. Returns the number of bytes filled in (0 at the end
+ * of the directory), or -1 with curthr->kt_errno set.
+ */
+static int
+sys_getdents(getdents_args_t *arg)
+{
+	getdents_args_t getdents_params;
+	file_t *f = NULL;
+	vnode_t *vn = NULL;
+	dirent_t *ents = NULL;
+	uint32_t bCount = 0, nent = 0, max = 0;
+	off_t pos = 0;
+	int val = 0, eof = 0;
 
 	if (copy_from_user(&getdents_params, arg, sizeof(getdents_params)) < 0) {
 		curthr->kt_errno = EFAULT;
 		return -1;
 	}
-
-	dirent_t * ptrDirent = kmalloc(sizeof(dirent_t));
-	if(!ptrDirent )
-	{
+	if ((0 > getdents_params.fd) || (NFILES <= getdents_params.fd)
+	    || (NULL == (f = fget(getdents_params.fd)))) {
+		curthr->kt_errno = EBADF;
+		return -1;
+	}
+	vn = f->f_vnode;
+	if (!S_ISDIR(vn->vn_mode)) {
+		fput(f);
+		curthr->kt_errno = ENOTDIR;
+		return -1;
+	}
+	if (getdents_params.count < sizeof(dirent_t)) {
+		fput(f);
+		curthr->kt_errno = EINVAL;
+		return -1;
+	}
+	if (NULL == (ents = kthread_bounce_page(curthr))) {
+		fput(f);
 		curthr->kt_errno = ENOMEM;
-		return NULL;
+		return -1;
 	}
-
-
-
-	while(getdents_params.count > bCount)
-	{
-		val = do_getdent(getdents_params.fd,  ptrDirent);
-		if(  0 > val)
-		{
-			curthr->kt_errno = -val;
-			return -1;
-		}else if(0 == val)
-		{
-			break;
+	KASSERT(NULL != vn->vn_ops->readdir && "function pointer not set");
+
+	pos = f->f_pos;
+	while (!eof) {
+		max = MIN((getdents_params.count - bCount) / sizeof(dirent_t),
+		          PAGE_SIZE / sizeof(dirent_t));
+		for (nent = 0; nent < max; nent++) {
+			if (0 >= (val = vn->vn_ops->readdir(vn, pos, &ents[nent]))) {
+				eof = 1;
+				break;
+			}
+			pos += val;
 		}
-		else
-		{
-			bCount =  bCount + val;
+		if (0 == nent)
+			break;
 
-			copy_to_user( arg->dirp,  ptrDirent, sizeof(dirent_t));
+		if (0 > copy_to_user((char *)getdents_params.dirp + bCount, ents,
+		                     nent * sizeof(dirent_t))) {
+			val = -EFAULT;
+			break;
 		}
+		bCount += nent * sizeof(dirent_t);
+		f->f_pos = pos;
 	}
+	fput(f);
 
-	kfree( ptrDirent);
-
-	if (0 > val)
-	{
+	if ((0 == bCount) && (0 > val)) {
 		curthr->kt_errno = -val;
 		return -1;
 	}
-
 	return bCount;
 }
 
@@ -460,6 +953,44 @@ static int sys_chdir(argstr_t *arg)
   } else return err;
 }
 
+#ifdef __GETCWD__
+/*
+ * Copies the path of the current directory into the user buffer,
+ * building it in the thread's bounce page first; see lookup_dirpath.
+ * Paths longer than a page fail with ERANGE. Returns the number of
+ * bytes copied, including the terminating null, or -1 with
+ * curthr->kt_errno set.
+ */
+static int sys_getcwd(getcwd_args_t *arg)
+{
+  getcwd_args_t   kern_args;
+  char            *path;
+  size_t          size;
+  int             err;
+
+  if ((err = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+    curthr->kt_errno = -err;
+    return -1;
+  }
+  if (NULL == (path = kthread_bounce_page(curthr))) {
+    curthr->kt_errno = ENOMEM;
+    return -1;
+  }
+
+  size = (kern_args.gcwd_size < PAGE_SIZE) ? kern_args.gcwd_size : PAGE_SIZE;
+  if ((err = lookup_dirpath(curproc->p_cwd, path, size)) < 0) {
+    curthr->kt_errno = -err;
+    return -1;
+  }
+  size = err + 1;
+  if ((err = copy_to_user(kern_args.gcwd_buf, path, size)) < 0) {
+    curthr->kt_errno = -err;
+    return -1;
+  }
+  return size;
+}
+#endif /* __GETCWD__ */
+
 static int sys_lseek(lseek_args_t *args)
 {
   lseek_args_t            kargs;
@@ -546,6 +1077,42 @@ static void *sys_mmap(mmap_args_t *arg)
   return ret;
 }
 
+static int sys_madvise(madvise_args_t *args)
+{
+  madvise_args_t          kargs;
+  int                     err;
+
+  if (copy_from_user(&kargs, args, sizeof(madvise_args_t))) {
+    curthr->kt_errno = EFAULT;
+    return -1;
+  }
+
+  err = do_madvise(kargs.mad_addr, kargs.mad_len, kargs.mad_advice);
+  if (err < 0) {
+    curthr->kt_errno = -err;
+    return -1;
+  }
+  return 0;
+}
+static void *sys_mremap(mremap_args_t *args)
+{
+  mremap_args_t           kargs;
+  void                    *ret;
+  int                     err;
+
+  if (copy_from_user(&kargs, args, sizeof(mremap_args_t)) < 0) {
+    curthr->kt_errno = EFAULT;
+    return MAP_FAILED;
+  }
+
+  err = do_mremap(kargs.mra_addr, kargs.mra_oldlen, kargs.mra_newlen,
+                  kargs.mra_flags, &ret);
+  if (err < 0) {
+    curthr->kt_errno = -err;
+    return MAP_FAILED;
+  }
+  return ret;
+}
 
 static pid_t sys_waitpid(waitpid_args_t *args)
 {
@@ -709,6 +1276,9 @@ static int sys_execve(execve_args_t *args, regs_t *regs)
       goto cleanup;
   }
 
+  /* the ring worker must not touch the old image once it goes; the
+   * ring is lost even if the exec fails */
+  ioring_destroy(curproc);
   err = do_execve(kern_filename, kern_argv, kern_envp, regs);
 
   curthr->kt_errno = -err;
@@ -844,6 +1414,12 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
   case SYS_munmap:
     return sys_munmap((munmap_args_t *) args);
 
+  case SYS_madvise:
+    return sys_madvise((madvise_args_t *) args);
+
+  case SYS_mremap:
+    return (int) sys_mremap((mremap_args_t *) args);
+
   case SYS_open:
     return sys_open((open_args_t *) args);
 
@@ -856,6 +1432,30 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
   case SYS_write:
     return sys_write((write_args_t *)args);
 
+  case SYS_readv:
+    return sys_rwv((rwv_args_t *)args, FMODE_READ);
+
+  case SYS_writev:
+    return sys_rwv((rwv_args_t *)args, FMODE_WRITE);
+
+  case SYS_pread:
+    return sys_prw((prw_args_t *)args, FMODE_READ);
+
+  case SYS_pwrite:
+    return sys_prw((prw_args_t *)args, FMODE_WRITE);
+
+  case SYS_sendfile:
+    return sys_sendfile((sendfile_args_t *)args);
+
+  case SYS_copy_file_range:
+    return sys_copy_file_range((cfr_args_t *)args);
+
+  case SYS_ring_setup:
+    return sys_ring_setup();
+
+  case SYS_ring_enter:
+    return sys_ring_enter((ring_enter_args_t *)args);
+
   case SYS_dup:
     return sys_dup((int)args);
 
@@ -880,6 +1480,11 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
   case SYS_chdir:
     return sys_chdir((argstr_t *)args);
 
+#ifdef __GETCWD__
+  case SYS_getcwd:
+    return sys_getcwd((getcwd_args_t *)args);
+#endif
+
   case SYS_getdents:
     return sys_getdents((getdents_args_t *)args);
 
@@ -0,0 +1,285 @@
+#include "kernel.h"
+#include "globals.h"
+#include "types.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/debug.h"
+
+#include "fs/dirent.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/dcache.h"
+
+/*
+ * Directory name cache.
+ *
+ * Entries are keyed on (fs, directory inode, name) rather than on the
+ * directory vnode, so that they outlive the vnodes they were made for
+ * and need no references. They live in a fixed table; when it is full
+ * the least recently used entry is taken over. "." and ".." are never
+ * entered, since the fs resolves ".." across mount points, and neither
+ * are names too long to be in a directory.
+ *
+ * Entries for directories are also hashed on (fs, child inode), so that
+ * getcwd can go from a directory to its parent and its name in it
+ * without scanning the parent. Directories have a single link, so there
+ * is at most one such entry per directory.
+ */
+
+typedef struct dcache_entry {
+        list_link_t     de_hlink;   /* hash chain, or the free list */
+        list_link_t     de_lrulink; /* on dcache_lru while in use */
+        list_link_t     de_rlink;   /* on dcache_rhash if de_isdir */
+        fs_t           *de_fs;      /* NULL if unused */
+        ino_t           de_dir;
+        ino_t           de_child;
+        int             de_negative;
+        int             de_isdir;   /* the child is a directory */
+        size_t          de_len;
+        char            de_name[NAME_LEN];
+} dcache_entry_t;
+
+static dcache_entry_t dcache_table[DCACHE_NENTRIES];
+static list_t dcache_hash[DCACHE_HASH_SIZE];
+static list_t dcache_rhash[DCACHE_HASH_SIZE];
+static list_t dcache_free;
+static list_t dcache_lru;       /* most recently used at the head */
+
+int dcache_enabled = 1;
+uint32_t dcache_nhits = 0;
+uint32_t dcache_nneg_hits = 0;
+uint32_t dcache_nmisses = 0;
+uint32_t dcache_nentries = 0;
+uint32_t dcache_seq = 0;
+uint32_t dcache_npurges = 0;
+uint32_t dcache_nwalked = 0;
+uint32_t dcache_nretries = 0;
+uint32_t dcache_nparents = 0;
+uint32_t dcache_nparent_misses = 0;
+
+static __attribute__((unused)) void
+dcache_init(void)
+{
+        int i;
+
+        list_init(&dcache_free);
+        list_init(&dcache_lru);
+        for (i = 0; i < DCACHE_HASH_SIZE; ++i) {
+                list_init(&dcache_hash[i]);
+                list_init(&dcache_rhash[i]);
+        }
+        for (i = 0; i < DCACHE_NENTRIES; ++i) {
+                dcache_table[i].de_fs = NULL;
+                list_link_init(&dcache_table[i].de_lrulink);
+                list_link_init(&dcache_table[i].de_rlink);
+                list_insert_tail(&dcache_free, &dcache_table[i].de_hlink);
+        }
+}
+init_func(dcache_init);
+
+static uint32_t
+hash_dcache(fs_t *fs, ino_t dir, const char *name, size_t len)
+{
+        uint32_t h = (((uint32_t)fs) >> 4) + (uint32_t)dir * 31;
+        size_t i;
+
+        for (i = 0; i < len; ++i)
+                h = h * 31 + (unsigned char)name[i];
+        return h % DCACHE_HASH_SIZE;
+}
+
+#define hash_dcache_child(fs, child)  (((((uint32_t)(fs)) >> 4) + (uint32_t)(child)) \
+                                       % DCACHE_HASH_SIZE)
+
+/* Returns 1 if (dir, name) may be entered in the cache. */
+static int
+dcache_cacheable(const char *name, size_t len)
+{
+        if ((0 == len) || (NAME_LEN <= len))
+                return 0;
+        if ((1 == len) && ('.' == name[0]))
+                return 0;
+        if ((2 == len) && ('.' == name[0]) && ('.' == name[1]))
+                return 0;
+        return 1;
+}
+
+static dcache_entry_t *
+dcache_find(fs_t *fs, ino_t dir, const char *name, size_t len)
+{
+        dcache_entry_t *de;
+
+        list_iterate_begin(&dcache_hash[hash_dcache(fs, dir, name, len)],
+                           de, dcache_entry_t, de_hlink) {
+                if ((fs == de->de_fs) && (dir == de->de_dir) && (len == de->de_len)
+                    && !strncmp(name, de->de_name, len))
+                        return de;
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+dcache_release(dcache_entry_t *de)
+{
+        list_remove(&de->de_hlink);
+        list_remove(&de->de_lrulink);
+        if (list_link_is_linked(&de->de_rlink))
+                list_remove(&de->de_rlink);
+        de->de_fs = NULL;
+        list_insert_head(&dcache_free, &de->de_hlink);
+        dcache_nentries--;
+        dcache_seq++;
+}
+
+/*
+ * Looks name up in dir. Returns 0 with a new reference to the vnode in
+ * *result, -ENOENT if the name is known not to exist, or DCACHE_MISS if
+ * the fs has to be asked. May block (in vget).
+ */
+int
+dcache_lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
+{
+        dcache_entry_t *de;
+
+        if (!dcache_enabled || !dcache_cacheable(name, len))
+                return DCACHE_MISS;
+        if (NULL == (de = dcache_find(dir->vn_fs, dir->vn_vno, name, len))) {
+                dcache_nmisses++;
+                return DCACHE_MISS;
+        }
+
+        list_remove(&de->de_lrulink);
+        list_insert_head(&dcache_lru, &de->de_lrulink);
+        if (de->de_negative) {
+                dcache_nneg_hits++;
+                return -ENOENT;
+        }
+        dcache_nhits++;
+        *result = vget(dir->vn_fs, de->de_child);
+        return 0;
+}
+
+/*
+ * Records the result of looking name up in dir: child, or NULL if the
+ * lookup failed with ENOENT.
+ */
+void
+dcache_enter(vnode_t *dir, const char *name, size_t len, vnode_t *child)
+{
+        dcache_entry_t *de;
+
+        if (!dcache_enabled || !dcache_cacheable(name, len))
+                return;
+        /* names of another fs would need more than an inode number */
+        if ((NULL != child) && (child->vn_fs != dir->vn_fs))
+                return;
+
+        if (NULL == (de = dcache_find(dir->vn_fs, dir->vn_vno, name, len))) {
+                if (list_empty(&dcache_free))
+                        dcache_release(list_tail(&dcache_lru, dcache_entry_t, de_lrulink));
+                de = list_head(&dcache_free, dcache_entry_t, de_hlink);
+                list_remove(&de->de_hlink);
+
+                de->de_fs = dir->vn_fs;
+                de->de_dir = dir->vn_vno;
+                de->de_len = len;
+                memcpy(de->de_name, name, len);
+                list_insert_head(&dcache_hash[hash_dcache(dir->vn_fs, dir->vn_vno, name, len)],
+                                 &de->de_hlink);
+                dcache_nentries++;
+        } else {
+                list_remove(&de->de_lrulink);
+                if (list_link_is_linked(&de->de_rlink))
+                        list_remove(&de->de_rlink);
+                dcache_seq++;
+        }
+        list_insert_head(&dcache_lru, &de->de_lrulink);
+        de->de_negative = (NULL == child);
+        de->de_child = (NULL == child) ? 0 : child->vn_vno;
+        de->de_isdir = (NULL != child) && S_ISDIR(child->vn_mode);
+        if (de->de_isdir)
+                list_insert_head(&dcache_rhash[hash_dcache_child(de->de_fs, de->de_child)],
+                                 &de->de_rlink);
+}
+
+/*
+ * Finds the parent of directory ino of fs and its name there. Returns 1
+ * with the parent's inode number in *parent and the name in *name and
+ * *len (not NUL terminated, valid until the cache changes), 0 if the
+ * cache does not know. Does not block.
+ */
+int
+dcache_parent(fs_t *fs, ino_t ino, ino_t *parent, const char **name, size_t *len)
+{
+        dcache_entry_t *de;
+
+        if (!dcache_enabled)
+                return 0;
+        list_iterate_begin(&dcache_rhash[hash_dcache_child(fs, ino)],
+                           de, dcache_entry_t, de_rlink) {
+                if ((fs == de->de_fs) && (ino == de->de_child)) {
+                        *parent = de->de_dir;
+                        *name = de->de_name;
+                        *len = de->de_len;
+                        dcache_nparents++;
+                        return 1;
+                }
+        } list_iterate_end();
+        dcache_nparent_misses++;
+        return 0;
+}
+
+/*
+ * Finds the directory name refers to in directory dir of fs without
+ * taking a reference on either. Returns 1 with its inode number in
+ * *child, 0 if the cache does not know of one. Does not block.
+ */
+int
+dcache_walk(fs_t *fs, ino_t dir, const char *name, size_t len, ino_t *child)
+{
+        dcache_entry_t *de;
+
+        if (!dcache_enabled || !dcache_cacheable(name, len))
+                return 0;
+        de = dcache_find(fs, dir, name, len);
+        if ((NULL == de) || de->de_negative || !de->de_isdir)
+                return 0;
+
+        list_remove(&de->de_lrulink);
+        list_insert_head(&dcache_lru, &de->de_lrulink);
+        dcache_nwalked++;
+        *child = de->de_child;
+        return 1;
+}
+
+/* Forgets what is known about name in dir. */
+void
+dcache_purge(vnode_t *dir, const char *name, size_t len)
+{
+        dcache_entry_t *de;
+
+        dcache_npurges++;
+        if ((NAME_LEN > len) && (NULL != (de = dcache_find(dir->vn_fs, dir->vn_vno, name, len))))
+                dcache_release(de);
+}
+
+/*
+ * Forgets every entry of fs: when a directory of it is removed (its
+ * inode number may be reused by a new directory, which must not inherit
+ * its entries) and when it is unmounted.
+ */
+void
+dcache_purge_fs(fs_t *fs)
+{
+        dcache_entry_t *de;
+
+        dcache_npurges++;
+        list_iterate_begin(&dcache_lru, de, dcache_entry_t, de_lrulink) {
+                if (fs == de->de_fs)
+                        dcache_release(de);
+        } list_iterate_end();
+}
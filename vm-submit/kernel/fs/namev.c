@@ -12,6 +12,7 @@
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/dcache.h"
 
 /* This takes a base 'dir', a 'name', its 'len', and a result vnode.
  * Most of the work should be done by the vnode's implementation
@@ -20,6 +21,9 @@
  *
  * If dir has no lookup(), return -ENOTDIR.
  *
+ * Names are looked up in the name cache first, and what the fs says
+ * about them is entered in it, including that they do not exist.
+ *
  * Note: returns with the vnode refcount on *result incremented.
  */
 int
@@ -42,8 +46,20 @@ lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
       vget((*result)->vn_fs, (*result)->vn_vno);
       return 0;
     }
+  int res = dcache_lookup(dir, name, len, result);
+  if(DCACHE_MISS != res)
+    return res;
+  /* the fs may sleep; an unlink or create of name meanwhile purges
+   * nothing, so the answer must not be cached past a purge */
+  uint32_t npurges = dcache_npurges;
   /*Parent .. Taken care inside lookup*/  
-  int res = dir->vn_ops->lookup(dir, name, len, result);
+  res = dir->vn_ops->lookup(dir, name, len, result);
+  if(npurges != dcache_npurges)
+    return res;
+  if(0 == res)
+    dcache_enter(dir, name, len, *result);
+  else if(-ENOENT == res)
+    dcache_enter(dir, name, len, NULL);
   return res;
 }
 
@@ -63,6 +79,11 @@ lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
  * vfs_root_vn.  dir_namev() should call lookup() to take care of resolving each
  * piece of the pathname.
  *
+ * The path is not copied: *name points into pathname, and is not
+ * terminated there if pathname has trailing slashes, so use *namelen.
+ * Directories which are only passed through are walked in the name
+ * cache where possible, without taking references on them.
+ *
  * Note: A successful call to this causes vnode refcount on *res_vnode to
  * be incremented.
  */
@@ -70,144 +91,102 @@ int
 dir_namev(const char *pathname, size_t *namelen, const char **name,
           vnode_t *base, vnode_t **res_vnode)
 {
-    const char separator = '/';
-    
-  vnode_t* tempVnode = NULL;
-  
-  
-  
-  
-  
+  const char *comp = NULL, *next = NULL, *last = NULL, *end = NULL;
+  vnode_t *dir = NULL, *child = NULL;
+  fs_t *fs = NULL;
+  ino_t ino = 0;
+  uint32_t seq = 0;
+  size_t len = 0;
+  int res = 0;
+
   KASSERT(pathname);
   KASSERT(res_vnode);
   KASSERT(namelen);
   KASSERT(name);
 
-  char localPathArr[MAXPATHLEN];
-  strcpy(localPathArr,pathname);
-   
+  if('\0' == pathname[0])
+    return -EINVAL;
   if(NULL == base)
     base = curproc->p_cwd;
-  
-  int i = 0;
-  if(pathname[i] != '/')
+  if('/' == pathname[0])
+    base = vfs_root_vn;
+
+  /* the basename is the last component; trailing slashes do not count */
+  for(end = pathname + strlen(pathname); (end > pathname) && ('/' == end[-1]); end--)
+    ;
+  for(last = end; (last > pathname) && ('/' != last[-1]); last--)
+    ;
+  if(last == end)
     {
-          tempVnode = base;
-      
+      /* "/", "//", ...: the root is its own parent */
+      *res_vnode = vget(base->vn_fs, base->vn_vno);
+      *name = pathname;
+      *namelen = 1;
+      return 0;
     }
-  else
+  if(NAME_LEN < (size_t)(end - last))
+    return -ENAMETOOLONG;
+
+  /*
+   * Walk the directories in between through the name cache by inode
+   * number, taking no references, as far as it knows them. Nothing in
+   * here blocks, so the entries cannot change under us; only the vget
+   * of where we stopped can, after which dcache_seq tells us whether
+   * the walk still stands.
+   */
+  for(comp = pathname; '/' == *comp; comp++)
+    ;
+  fs = base->vn_fs;
+  ino = base->vn_vno;
+  seq = dcache_seq;
+  for( ; comp < last; comp = next)
     {
-          i++;
-                tempVnode = vfs_root_vn;    
+      for(next = comp; '/' != *next; next++)
+        ;
+      len = next - comp;
+      while('/' == *next)
+        next++;
+      if(NAME_LEN < len)
+        return -ENAMETOOLONG;
+      if((1 == len) && ('.' == *comp))
+        continue;
+      if(!dcache_walk(fs, ino, comp, len, &ino))
+        break;
     }
-        
-  vget(tempVnode->vn_fs,tempVnode->vn_vno);
-  
-  
-  
-  if(localPathArr[i] == '\0')
+  dir = vget(fs, ino);
+  if(seq != dcache_seq)
     {
-      if(0 == i)
-        {
-          vput(tempVnode);
-          return -EINVAL;
-        }
-      else
-        {
-              *res_vnode = tempVnode;
-              *namelen = strlen(pathname);
-          *name = pathname;
-          
-          
-          return 0;
-        }
+      /* start over, the slow way */
+      dcache_nretries++;
+      vput(dir);
+      dir = vget(base->vn_fs, base->vn_vno);
+      for(comp = pathname; '/' == *comp; comp++)
+        ;
     }
-  char* localPtr  = &localPathArr[i];
-  
-  char *tempRes = strchr( localPtr, separator );
-  if(NULL != tempRes)
-    *tempRes++ = '\0';
-  
 
-  if(0 < strlen(localPtr))
+  /* the rest one lookup, and one reference, at a time */
+  for( ; comp < last; comp = next)
     {
-          *namelen = strlen(localPtr);
-      if( NAME_LEN < *namelen)
+      for(next = comp; '/' != *next; next++)
+        ;
+      len = next - comp;
+      while('/' == *next)
+        next++;
+      if(NAME_LEN < len)
         {
-          vput(tempVnode);
+          vput(dir);
           return -ENAMETOOLONG;
         }
+      res = lookup(dir, comp, len, &child);
+      vput(dir);
+      if(0 > res)
+        return res;
+      dir = child;
     }
-  vnode_t* vnodeObj = NULL;
-  int res =0;
-  for( ;NULL != localPtr ; ) 
-    {
-         vnodeObj = NULL;
-      res = lookup(tempVnode,localPtr, strlen(localPtr), &vnodeObj);
-      localPtr = tempRes;    
-      if(NULL == localPtr)
-        {
-
-              if(0 <= res)
-                {
-                  vput(vnodeObj);
-                }                   
-              if((0 > res) && (-ENOENT != res))
-                {
-                  vput(tempVnode);
-                  return res;
-                }
-              
-        }
-      else
-        {       
-          
-          
-          if(localPtr == '\0')
-            {
-              if( 0 > res)
-                {
 
-                      vput(tempVnode);
-                      return res;
-                }
-                        
-              else if( -ENOENT != res)
-                {
-                  
-                  vput(vnodeObj);
-                }
-
-              break;
-            }
-          tempRes = strchr( localPtr, separator );
-          if(NULL != tempRes)
-            *tempRes++ = '\0';
-          if(0 > res )
-            {
-              vput(tempVnode);
-              return res;
-            }
-          *namelen = strlen(localPtr);
-          if(NAME_LEN <  *namelen  )
-            {
-                  vput(vnodeObj);
-              vput(tempVnode);
-              
-              return -ENAMETOOLONG;
-            }
-          vput(tempVnode);
-          tempVnode = vnodeObj;
-          
-        }
-        
-    }
-  
-  *res_vnode =  tempVnode;
-  KASSERT(*res_vnode);
-  *name = pathname+strlen(pathname)-*namelen;
-  
- 
+  *res_vnode = dir;
+  *name = last;
+  *namelen = end - last;
   return 0;
 }
 
@@ -251,6 +230,7 @@ open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *base)
           
           KASSERT(tempNode->vn_ops->create);   
                     res = tempNode->vn_ops->create(tempNode,file_naav,length,res_vnode);
+          dcache_purge(tempNode, file_naav, length);
         }
     }
     
@@ -260,6 +240,22 @@ open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *base)
 }
 
 #ifdef __GETCWD__
+/* Copies the len bytes at name into buf as a string, as much of it as
+ * fits. Returns 0, or -ERANGE if it was cut short. */
+static int
+lookup_name_copy(const char *name, size_t len, char *buf, size_t size)
+{
+  if(len < size)
+    {
+      memcpy(buf, name, len);
+      buf[len] = '\0';
+      return 0;
+    }
+  memcpy(buf, name, size - 1);
+  buf[size - 1] = '\0';
+  return -ERANGE;
+}
+
 /* Finds the name of 'entry' in the directory 'dir'. The name is writen
  * to the given buffer. On success 0 is returned. If 'dir' does not
  * contain 'entry' then -ENOENT is returned. If the given buffer cannot
@@ -267,28 +263,145 @@ open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *base)
  * and a null terminator, -ERANGE is returned.
  *
  * Files can be uniquely identified within a file system by their
- * inode numbers. */
+ * inode numbers.
+ *
+ * The name cache knows the name of most directories in their parent,
+ * so dir is only scanned when it does not; a directory found by the
+ * scan is entered in the cache for next time. */
 int
 lookup_name(vnode_t *dir, vnode_t *entry, char *buf, size_t size)
 {
-  NOT_YET_IMPLEMENTED("GETCWD: lookup_name");
-  return -ENOENT;
+  const char *cname = NULL;
+  size_t clen = 0;
+  ino_t parent = 0;
+  dirent_t d;
+  off_t pos = 0;
+  int res = 0;
+  uint32_t npurges;
+
+  KASSERT(dir);
+  KASSERT(entry);
+  KASSERT(buf);
+
+  if(0 == size)
+    return -ERANGE;
+  if((dir->vn_fs == entry->vn_fs)
+     && dcache_parent(entry->vn_fs, entry->vn_vno, &parent, &cname, &clen)
+     && (parent == dir->vn_vno))
+    return lookup_name_copy(cname, clen, buf, size);
+
+  if(!dir->vn_ops->readdir)
+    return -ENOTDIR;
+  npurges = dcache_npurges;
+  while(0 < (res = dir->vn_ops->readdir(dir, pos, &d)))
+    {
+      pos += res;
+      if(d.d_ino != entry->vn_vno)
+        continue;
+      if(!strcmp(d.d_name, ".") || !strcmp(d.d_name, ".."))
+        continue;
+      clen = strlen(d.d_name);
+      if(S_ISDIR(entry->vn_mode) && (npurges == dcache_npurges))
+        dcache_enter(dir, d.d_name, clen, entry);
+      return lookup_name_copy(d.d_name, clen, buf, size);
+    }
+  return (0 > res) ? res : -ENOENT;
 }
 
 
 /* Used to find the absolute path of the directory 'dir'. Since
  * directories cannot have more than one link there is always
  * a unique solution. The path is writen to the given buffer.
- * On success 0 is returned. On error this function returns a
- * negative error code. See the man page for getcwd(3) for
- * possible errors. Even if an error code is returned the buffer
- * will be filled with a valid string which has some partial
- * information about the wanted path. */
+ * On success the length of the path is returned. On error this
+ * function returns a negative error code. See the man page for
+ * getcwd(3) for possible errors. Even if an error code is returned
+ * the buffer will be filled with a valid string which has some
+ * partial information about the wanted path.
+ *
+ * The path is built backwards from the end of buf, one directory at a
+ * time. Where the name cache knows a directory's parent and name the
+ * step is taken by inode number, without a reference or a scan; such
+ * steps do not block, so the name is copied before anything can change.
+ * Otherwise the parent is found with ".." and the name with lookup_name,
+ * which enters it in the cache. */
 ssize_t
 lookup_dirpath(vnode_t *dir, char *buf, size_t osize)
 {
-  NOT_YET_IMPLEMENTED("GETCWD: lookup_dirpath");
+  char name[NAME_LEN];
+  const char *cname = NULL;
+  size_t clen = 0, pos = 0;
+  vnode_t *cur = NULL, *par = NULL;
+  fs_t *fs = NULL;
+  ino_t ino = 0, parent = 0;
+  int res = 0;
 
-  return -ENOENT;
+  KASSERT(dir);
+  KASSERT(buf);
+
+  if(0 == osize)
+    return -EINVAL;
+  pos = osize - 1;
+  buf[pos] = '\0';
+  fs = dir->vn_fs;
+  ino = dir->vn_vno;
+  while((fs != vfs_root_vn->vn_fs) || (ino != vfs_root_vn->vn_vno))
+    {
+      if(dcache_parent(fs, ino, &parent, &cname, &clen))
+        {
+          if(clen + 1 > pos)
+            {
+              res = -ERANGE;
+              break;
+            }
+          pos -= clen;
+          memcpy(buf + pos, cname, clen);
+          buf[--pos] = '/';
+          ino = parent;
+          continue;
+        }
+
+      cur = vget(fs, ino);
+      if(0 > (res = lookup(cur, "..", 2, &par)))
+        {
+          vput(cur);
+          break;
+        }
+      if(par == cur)
+        {
+          /* the root of a file system which is not mounted anywhere */
+          vput(par);
+          vput(cur);
+          break;
+        }
+      res = lookup_name(par, cur, name, sizeof(name));
+      fs = par->vn_fs;
+      ino = par->vn_vno;
+      vput(par);
+      vput(cur);
+      if(0 > res)
+        break;
+      clen = strlen(name);
+      if(clen + 1 > pos)
+        {
+          res = -ERANGE;
+          break;
+        }
+      pos -= clen;
+      memcpy(buf + pos, name, clen);
+      buf[--pos] = '/';
+    }
+
+  if((osize - 1 == pos) && (0 == res))
+    {
+      /* dir is the root */
+      if(2 > osize)
+        {
+          buf[0] = '\0';
+          return -ERANGE;
+        }
+      buf[--pos] = '/';
+    }
+  memmove(buf, buf + pos, osize - pos);
+  return (0 > res) ? res : (ssize_t)(osize - 1 - pos);
 }
 #endif /* __GETCWD__ */
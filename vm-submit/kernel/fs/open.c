@@ -16,17 +16,26 @@
 #include "fs/vfs_syscall.h"
 #include "fs/open.h"
 #include "fs/stat.h"
+#include "fs/fdtable.h"
 #include "util/debug.h"
 
-/* find empty index in p->p_files[] */
+/*
+ * find empty index in p->p_files[]: the first clear bit of the first
+ * word of the descriptor bitmap which is not full
+ */
 int
 get_empty_fd(proc_t *p)
 {
-	int fd;
-
-	for (fd = 0; fd < NFILES; fd++) {
-		if (!p->p_files[fd])
+	uint32_t *map = proc_fdmap(p);
+	int i, fd;
+
+	for (i = 0; i < FD_NWORDS; i++) {
+		if (0xffffffff == map[i])
+			continue;
+		fd = i * 32 + __builtin_ctz(~map[i]);
+		if (fd < NFILES)
 			return fd;
+		break;
 	}
 
 	dbg(DBG_ERROR | DBG_VFS, "ERROR: get_empty_fd: out of file descriptors "
@@ -34,6 +43,67 @@ get_empty_fd(proc_t *p)
 	return -EMFILE;
 }
 
+/* Puts f in slot fd of p's table, which must be free. */
+void
+fd_install(proc_t *p, int fd, file_t *f)
+{
+	uint32_t *map = proc_fdmap(p);
+
+	KASSERT(0 <= fd && fd < NFILES);
+	KASSERT(NULL == p->p_files[fd]);
+	KASSERT(NULL != f);
+
+	p->p_files[fd] = f;
+	map[fd / 32] |= (1 << (fd % 32));
+}
+
+/* Empties slot fd of p's table and returns what was in it. */
+file_t *
+fd_clear(proc_t *p, int fd)
+{
+	uint32_t *map = proc_fdmap(p);
+	file_t *f;
+
+	KASSERT(0 <= fd && fd < NFILES);
+
+	f = p->p_files[fd];
+	p->p_files[fd] = NULL;
+	map[fd / 32] &= ~(1 << (fd % 32));
+	return f;
+}
+
+/* Returns the lowest open descriptor of p which is >= fd, or -1. */
+int
+fd_next(proc_t *p, int fd)
+{
+	uint32_t *map = proc_fdmap(p);
+	uint32_t word;
+	int i;
+
+	if (fd < 0)
+		fd = 0;
+	for (i = fd / 32; i < FD_NWORDS; i++) {
+		word = map[i];
+		if (i == fd / 32)
+			word &= ~((1 << (fd % 32)) - 1);
+		if (0 != word)
+			return i * 32 + __builtin_ctz(word);
+	}
+	return -1;
+}
+
+/* Returns the number of open descriptors of p. */
+int
+fd_count(proc_t *p)
+{
+	uint32_t *map = proc_fdmap(p);
+	int i, n = 0;
+
+	for (i = 0; i < FD_NWORDS; i++)
+		n += __builtin_popcount(map[i]);
+	return n;
+}
+
 /*
  * There a number of steps to opening a file:
  *      1. Get the next empty file descriptor.
@@ -68,13 +138,17 @@ get_empty_fd(proc_t *p)
  *      o ENXIO
  *        pathname refers to a device special file and no corresponding device
  *        exists.
+ *
+ * do_open_in does this for the table of process p, with relative paths
+ * starting at p's current directory; the I/O ring worker uses it to open
+ * files on behalf of other processes. do_open is do_open_in(curproc).
  */
 
 int
-do_open(const char *filename, int oflags)
+do_open_in(proc_t *p, const char *filename, int oflags)
 {
 
-	int nxtEmptyFDesc = get_empty_fd(curproc);
+	int nxtEmptyFDesc = get_empty_fd(p);
 	if(nxtEmptyFDesc < 0 )
 		return -EMFILE;
 
@@ -86,7 +160,7 @@ do_open(const char *filename, int oflags)
 		return -EINVAL;
 
 
-	curproc->p_files[nxtEmptyFDesc]=newFile;
+	fd_install(p, nxtEmptyFDesc, newFile);
 
 	newFile->f_mode = FMODE_READ;
 	if (oflags & O_WRONLY) {
@@ -102,23 +176,23 @@ do_open(const char *filename, int oflags)
 
 	int temp_return = 0;
 	vnode_t *new_vnode = NULL;
-	temp_return = open_namev(filename,oflags,&new_vnode,NULL);
+	temp_return = open_namev(filename,oflags,&new_vnode,p->p_cwd);
 	if(!(temp_return>=0)){
+		fd_clear(p, nxtEmptyFDesc);
 		fput(newFile);
-		curproc->p_files[nxtEmptyFDesc] = NULL;
 		return temp_return;
 	}
 
 	if ( ( (oflags & O_RDWR) || (oflags & O_WRONLY)) && S_ISDIR(new_vnode->vn_mode))
 	{
-		curproc->p_files[nxtEmptyFDesc] = NULL;
+		fd_clear(p, nxtEmptyFDesc);
 		vput(new_vnode);
 		fput(newFile);
 		return -EISDIR;
 	}
 
 	if (( ( !new_vnode->vn_bdev) && S_ISBLK(new_vnode->vn_mode)) || ((!new_vnode->vn_cdev)  &&  S_ISCHR(new_vnode->vn_mode)) ){
-		curproc->p_files[nxtEmptyFDesc] = NULL;
+		fd_clear(p, nxtEmptyFDesc);
 		vput(new_vnode);
 		fput(newFile);
 		return -ENXIO;
@@ -128,3 +202,9 @@ do_open(const char *filename, int oflags)
 
 	return nxtEmptyFDesc;
 }
+
+int
+do_open(const char *filename, int oflags)
+{
+	return do_open_in(curproc, filename, oflags);
+}
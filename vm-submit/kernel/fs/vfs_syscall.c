@@ -20,6 +20,8 @@
 #include "util/string.h"
 #include "util/printf.h"
 #include "fs/stat.h"
+#include "fs/dcache.h"
+#include "fs/fdtable.h"
 #include "util/debug.h"
 
 /* To read a file:
@@ -149,8 +151,7 @@ do_close(int fd)
         if(curproc->p_files[fd] == NULL)
                 return -EBADF;
 
-        file_t* ftemp =curproc->p_files[fd];
-        curproc->p_files[fd]=NULL;
+        file_t* ftemp = fd_clear(curproc, fd);
         fput(ftemp);
         return 0;
 }
@@ -182,17 +183,6 @@ do_dup(int fd)
         if(curproc->p_files[fd] == NULL)
                 return -EBADF;
 
-        int count=0,i=0;
-        for(i=0;i<NFILES;i++)
-        {
-                if(curproc->p_files[fd]!=NULL)
-                {
-                        count++;
-                }
-        }
-        if(count==NFILES-1)
-                return -EMFILE;
-
         file_t* fOld = fget(fd);
         if(fOld == NULL)
         {
@@ -207,7 +197,7 @@ do_dup(int fd)
                 return -EMFILE;
         }
 
-        curproc->p_files[fdNew]=fOld;
+        fd_install(curproc, fdNew, fOld);
         return fdNew;
 
 }
@@ -251,7 +241,7 @@ do_dup2(int ofd, int nfd)
                 do_close(nfd);
             }
 
-        curproc -> p_files[nfd] = fOld;
+        fd_install(curproc, nfd, fOld);
         return nfd;
 }
 
@@ -319,6 +309,7 @@ do_mknod(const char *path, int mode, unsigned devid)
         KASSERT(NULL != res_node->vn_ops->mknod && "function pointer not set ");
         dbg(DBG_ALL, "(GRADING2 3.b):res_node's mknod virtual function is valid and not NULL.\n");
         retVal= res_node->vn_ops->mknod(res_node, name, namelen, mode, devid);
+        dcache_purge(res_node, name, namelen);
         vput(res_node);
 
         return retVal;
@@ -371,6 +362,7 @@ do_mkdir(const char *path)
         KASSERT(NULL != resultnode->vn_ops->mkdir);
         dbg(DBG_ALL, "(GRADING2 3.c):res_node's mkdir virtual function is valid and not NULL.\n");
         returnVal = resultnode -> vn_ops -> mkdir(resultnode, newDirname, length);
+        dcache_purge(resultnode, newDirname, length);
         vput(resultnode);
 
         return returnVal;
@@ -421,12 +413,12 @@ do_rmdir(const char *path)
                 return -ENAMETOOLONG;
         }
 
-        if(  0 == strcmp(newDirname,".")){
+        if((1 == length) && (0 == strncmp(newDirname, ".", 1))){
                 vput(resultNode);
                 return -EINVAL;
         }
 
-        if( 0 == strcmp(newDirname,"..")  ){
+        if((2 == length) && (0 == strncmp(newDirname, "..", 2))){
                 vput(resultNode);
                 return -ENOTEMPTY;
         }
@@ -436,6 +428,8 @@ do_rmdir(const char *path)
         dbg(DBG_ALL, "(GRADING2 3.d):res_node's rmdir virtual function is valid and not NULL.\n");
 
         retVal = resultNode -> vn_ops -> rmdir(resultNode,newDirname,length);
+        if (0 == retVal)
+                dcache_purge_fs(resultNode->vn_fs);
         vput(resultNode);
         return retVal;
 }
@@ -496,6 +490,7 @@ do_unlink(const char *path)
         dbg(DBG_ALL, "(GRADING2 3.e):res_node's unlink virtual function is valid and not NULL.\n");
 
         retVAl = res_node->vn_ops->unlink(res_node, newFilename, length);
+        dcache_purge(res_node, newFilename, length);
 
         vput(res_node);
         vput(res_node2);
@@ -566,6 +561,7 @@ do_link(const char *from, const char *to)
     }
   
   retVal = tempVnode->vn_ops->link(res_vnode, tempVnode, naav, length);
+  dcache_purge(tempVnode, naav, length);
   
   vput(res_vnode);
   vput(tempVnode);
@@ -13,7 +13,10 @@
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/vcache.h"
+#include "fs/dcache.h"
 #include "mm/slab.h"
+#include "mm/pframe.h"
 #include "proc/sched.h"
 #include "util/debug.h"
 #include "vm/vmmap.h"
@@ -21,7 +24,52 @@
 
 static slab_allocator_t *vnode_allocator;
 
-static list_t vnode_inuse_list;
+/*
+ * vn_link chains a vnode in its hash bucket. The link on the list of
+ * its file system and the one on the inactive list are in the wrapper
+ * below (see proc/procstat.h). fs_t is allocated by vfs.c, not here,
+ * so it cannot be wrapped the same way; the list heads live in a
+ * small table, a slot being claimed by the first vnode of a file
+ * system and given back with its last one.
+ *
+ * A vnode whose last reference goes away while its file is still
+ * linked is not deleted right away, but kept, unreferenced, at the head
+ * of the inactive list (and in the hash table) for vget to revive. The
+ * list is trimmed from its tail when it grows past vnode_inactive_max,
+ * by pageoutd when memory runs low (the file system may be holding a
+ * page for each vnode), and for a file system which is being flushed.
+ */
+typedef struct vnode_node {
+        vnode_t         vt_vn;
+        list_link_t     vt_fslink;
+        list_link_t     vt_lrulink;  /* on vnode_inactive_list if inactive */
+} vnode_node_t;
+
+#define vnode_node(vn)  CONTAINER_OF((vn), vnode_node_t, vt_vn)
+
+typedef struct vnode_fslist {
+        fs_t           *vf_fs;
+        list_t          vf_list;
+        int             vf_count;
+} vnode_fslist_t;
+
+#define hash_vnode(fs, vno)  (((((uint32_t)(fs)) >> 4) + (uint32_t)(vno)) \
+                              % VNODE_HASH_SIZE)
+
+static list_t vnode_hash[VNODE_HASH_SIZE];
+static vnode_fslist_t vnode_fslists[VNODE_MAXFS];
+static list_t vnode_inactive_list;
+
+int vnode_inactive_max = VNODE_INACTIVE_MAX;
+uint32_t vnode_ninactive = 0;
+uint32_t vnode_nrevived = 0;
+uint32_t vnode_nread = 0;
+uint32_t vnode_nevicted = 0;
+
+uint32_t vnode_nlookups = 0;
+uint32_t vnode_nhits = 0;
+uint32_t vnode_nprobes = 0;
+uint32_t vnode_ncount = 0;
 
 /* Related to vnodes representing special files: */
 static void init_special_vnode(vnode_t *vn);
@@ -93,11 +141,43 @@ static vnode_ops_t blockdev_spec_vops = {
 static __attribute__((unused)) void
 vnode_init(void)
 {
-        list_init(&vnode_inuse_list);
-        vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_t));
+        int i;
+
+        for (i = 0; i < VNODE_HASH_SIZE; ++i)
+                list_init(&vnode_hash[i]);
+        for (i = 0; i < VNODE_MAXFS; ++i) {
+                vnode_fslists[i].vf_fs = NULL;
+                list_init(&vnode_fslists[i].vf_list);
+                vnode_fslists[i].vf_count = 0;
+        }
+        list_init(&vnode_inactive_list);
+        vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_node_t));
 }
 init_func(vnode_init);
 
+/*
+ * Returns the list of the vnodes of fs, claiming a free slot for it if
+ * create is set and it has none yet. NULL if fs has no vnodes.
+ */
+static vnode_fslist_t *
+vnode_fslist(fs_t *fs, int create)
+{
+        vnode_fslist_t *slot = NULL;
+        int i;
+
+        for (i = 0; i < VNODE_MAXFS; ++i) {
+                if (fs == vnode_fslists[i].vf_fs)
+                        return &vnode_fslists[i];
+                if ((NULL == slot) && (NULL == vnode_fslists[i].vf_fs))
+                        slot = &vnode_fslists[i];
+        }
+        if (!create)
+                return NULL;
+        KASSERT(NULL != slot && "too many file systems with vnodes");
+        slot->vf_fs = fs;
+        return slot;
+}
+
 /*
  * Core vnode management routines:
  */
@@ -115,14 +195,27 @@ vnode_t *
 vget(struct fs *fs, ino_t vno)
 {
         vnode_t *vn = NULL;
+        vnode_fslist_t *vf;
 
         KASSERT(fs);
 
+        vnode_nlookups++;
+
         /* look for inuse vnode */
 find:
-        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
+        list_iterate_begin(&vnode_hash[hash_vnode(fs, vno)], vn, vnode_t, vn_link) {
+                vnode_nprobes++;
                 if ((vn->vn_fs == fs) && (vn->vn_vno == vno)) {
                         /* found it... */
+                        if ((0 == vn->vn_refcount) && !(VN_BUSY & vn->vn_flags)) {
+                                /* ...on the inactive list; revive it */
+                                list_remove(&vnode_node(vn)->vt_lrulink);
+                                vnode_ninactive--;
+                                vnode_nrevived++;
+                                vn->vn_refcount = 1;
+                                vnode_nhits++;
+                                return vn;
+                        }
                         if (VN_BUSY & vn->vn_flags) {
                                 /* it's either being brought in or it's on
                                  * its way out. Let's not race whomever is
@@ -141,9 +234,11 @@ find:
                            not the requested one (if none is
                            mounted then vn->vn_mount should
                            point back to vn) */
+                        vnode_nhits++;
                         vref(vn);
                         return vn;
 #else
+                        vnode_nhits++;
                         vref(vn->vn_mount);
                         return vn->vn_mount;
 #endif
@@ -161,6 +256,9 @@ find:
                 goto find;
         }
         memset(vn, 0, sizeof(vnode_t));
+        list_link_init(&vnode_node(vn)->vt_lrulink);
+        vnode_ncount++;
+        vnode_nread++;
         /*   initialize its contents: */
         /*     members that can be initialized here: */
         vn->vn_fs = fs;
@@ -177,14 +275,17 @@ find:
          *     vn_mode, vn_len, vn_i, and vn_devid (if
          *     appropriate)): */
 
-        /*       mark it busy and place it on vnode_inuse_list (so it can
+        /*       mark it busy and place it in the hash table (so it can
          *       be found while we are possibly blocking): (also, seems
          *       appropriate not to ref it yet since no references from
          *       outside this context (vnode.c) will exist until we are
          *       done bringing the vnode in)
          */
         vn->vn_flags |= VN_BUSY;
-        list_insert_head(&vnode_inuse_list, &vn->vn_link);
+        list_insert_head(&vnode_hash[hash_vnode(fs, vno)], &vn->vn_link);
+        vf = vnode_fslist(fs, 1);
+        list_insert_head(&vf->vf_list, &vnode_node(vn)->vt_fslink);
+        vf->vf_count++;
 
         KASSERT(vn->vn_fs->fs_op && vn->vn_fs->fs_op->read_vnode);
         /*       this is where we might block (depending on the underlying
@@ -225,6 +326,75 @@ find:
  *       should be zero)
  *     - free the vnode
  */
+/*
+ * Deletes vn, which has no references and no resident pages left, and
+ * frees it. May block in the file system.
+ */
+static void
+vnode_free(vnode_t *vn)
+{
+        vnode_fslist_t *vf;
+
+        KASSERT(0 == vn->vn_refcount);
+        KASSERT(0 == vn->vn_nrespages);
+
+        vn->vn_flags |= VN_BUSY;
+        if (vn->vn_fs->fs_op->delete_vnode) {
+                vn->vn_fs->fs_op->delete_vnode(vn);
+        }
+        /* (really no need to clear VN_BUSY): */
+
+#ifndef NDEBUG
+        if (!sched_queue_empty(&vn->vn_waitq)) {
+                dbg(DBG_VNREF, "vput: wow, found thread(s) trying to vget "
+                    "(%p, %p ino %ld) after returning from delete_vnode.\n",
+                    vn, vn->vn_fs, (long)vn->vn_vno);
+        }
+#endif
+
+        /* wake up anyone who might have attempted to vget this vnode while
+         * we were taking it away: */
+        sched_broadcast_on(&vn->vn_waitq);
+
+        list_remove(&vn->vn_link); /* remove from its hash bucket */
+        vf = vnode_fslist(vn->vn_fs, 0);
+        KASSERT(NULL != vf);
+        list_remove(&vnode_node(vn)->vt_fslink);
+        if (0 == --vf->vf_count)
+                vf->vf_fs = NULL;
+        vnode_ncount--;
+        slab_obj_free(vnode_allocator, vnode_node(vn));
+}
+
+/*
+ * Deletes up to n vnodes from the tail of the inactive list, or only
+ * those of fs if fs is not NULL. Returns the number deleted. May block.
+ */
+int
+vnode_inactive_trim(struct fs *fs, int n)
+{
+        list_link_t *link;
+        vnode_t *vn;
+        int ndone = 0;
+
+        link = vnode_inactive_list.l_prev;
+        while ((ndone < n) && (link != &vnode_inactive_list)) {
+                vn = &list_item(link, vnode_node_t, vt_lrulink)->vt_vn;
+                link = link->l_prev;
+                if ((NULL != fs) && (fs != vn->vn_fs))
+                        continue;
+
+                list_remove(&vnode_node(vn)->vt_lrulink);
+                vnode_ninactive--;
+                vnode_nevicted++;
+                vnode_free(vn);
+                ndone++;
+                /* the list may have changed while we blocked */
+                link = vnode_inactive_list.l_prev;
+        }
+        return ndone;
+}
+
 void
 vput(struct vnode *vn)
 {
@@ -276,30 +446,21 @@ vput(struct vnode *vn)
         KASSERT(vn->vn_mount == vn);
 #endif
 
-        /* no res pages and no more active references; free the vnode */
+        /* no res pages and no more active references. Keep the vnode
+         * for a later vget if its file is still there, unless it is the
+         * root of its fs, which only goes away when the fs does. */
         KASSERT(0 == vn->vn_refcount);
         KASSERT(0 == vn->vn_nrespages);
 
-        vn->vn_flags |= VN_BUSY;
-        if (vn->vn_fs->fs_op->delete_vnode) {
-                vn->vn_fs->fs_op->delete_vnode(vn);
-        }
-        /* (really no need to clear VN_BUSY): */
-
-#ifndef NDEBUG
-        if (!sched_queue_empty(&vn->vn_waitq)) {
-                dbg(DBG_VNREF, "vput: wow, found thread(s) trying to vget "
-                    "(%p, %p ino %ld) after returning from delete_vnode.\n",
-                    vn, vn->vn_fs, (long)vn->vn_vno);
+        if ((0 < vnode_inactive_max) && (vn != vn->vn_fs->fs_root)
+            && vn->vn_fs->fs_op->query_vnode(vn)) {
+                list_insert_head(&vnode_inactive_list, &vnode_node(vn)->vt_lrulink);
+                vnode_ninactive++;
+                if ((int)vnode_ninactive > vnode_inactive_max)
+                        vnode_inactive_trim(NULL, vnode_ninactive - vnode_inactive_max);
+                return;
         }
-#endif
-
-        /* wake up anyone who might have attempted to vget this vnode while
-         * we were taking it away: */
-        sched_broadcast_on(&vn->vn_waitq);
-
-        list_remove(&vn->vn_link); /* remove from vn_inuse_list */
-        slab_obj_free(vnode_allocator, vn);
+        vnode_free(vn);
 }
 
 int
@@ -319,20 +480,19 @@ vfs_is_in_use(fs_t *fs)
          *             - return -EBUSY
          *
          */
-        list_t *list = &vnode_inuse_list;
+        vnode_fslist_t *vf = vnode_fslist(fs, 0);
         list_link_t *link;
         int ret = 0;
-        for (link = list->l_next; link != list; link = link->l_next) {
-                vnode_t *vn = list_item(link, vnode_t, vn_link);
+
+        if (NULL == vf)
+                return 0;
+        for (link = vf->vf_list.l_next; link != &vf->vf_list; link = link->l_next) {
+                vnode_t *vn = &list_item(link, vnode_node_t, vt_fslink)->vt_vn;
                 int refs;
 
                 KASSERT(vn->vn_refcount >= vn->vn_nrespages);
                 KASSERT(vn->vn_nrespages >= 0);
-
-                if (fs != vn->vn_fs)
-                        continue;
-
-                /* otherwise, vn belongs to the given fs */
+                KASSERT(fs == vn->vn_fs);
 
                 /* if it is the root vnode and it has more than one
                  * reference
@@ -361,12 +521,21 @@ vfs_is_in_use(fs_t *fs)
 void
 vnode_flush_all(struct fs *fs)
 {
+        vnode_fslist_t *vf;
+        vnode_node_t *node;
         vnode_t *v;
         pframe_t *p;
         int err;
 
+        /* the fs is going away; so do the vnodes and names kept for it */
+        vnode_inactive_trim(fs, vnode_ninactive);
+        dcache_purge_fs(fs);
+
 clean:
-        list_iterate_begin(&vnode_inuse_list, v, vnode_t, vn_link) {
+        if (NULL == (vf = vnode_fslist(fs, 0)))
+                return;
+        list_iterate_begin(&vf->vf_list, node, vnode_node_t, vt_fslink) {
+                v = &node->vt_vn;
                 list_iterate_begin(&v->vn_mmobj.mmo_respages,
                                    p, pframe_t, pf_olink) {
                         if (pframe_is_dirty(p)) {
@@ -385,8 +554,10 @@ clean:
         } list_iterate_end();
 
         /* all pages of all vnodes belonging to this fs have been cleaned.
-         * Now, uncache all of them: */
-        list_iterate_begin(&vnode_inuse_list, v, vnode_t, vn_link) {
+         * Now, uncache all of them (freeing the last page of a vnode may
+         * free the vnode and, with it, the slot of the fs): */
+        list_iterate_begin(&vf->vf_list, node, vnode_node_t, vt_fslink) {
+                v = &node->vt_vn;
                 list_iterate_begin(&v->vn_mmobj.mmo_respages,
                                    p, pframe_t, pf_olink) {
                         KASSERT(!pframe_is_dirty(p));
@@ -402,14 +573,42 @@ clean:
 int
 vnode_inuse(struct fs *fs)
 {
-        vnode_t *vn;
-        int n = 0;
+        vnode_fslist_t *vf = vnode_fslist(fs, 0);
 
-        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
-                if (vn->vn_fs == fs)
-                        n++;
-        } list_iterate_end();
-        return n;
+        return (NULL == vf) ? 0 : vf->vf_count;
+}
+
+/*
+ * Finds the page cache page of vn, a regular file, holding byte pos,
+ * pins it and returns it in *pfp. Returns how many of the len bytes
+ * from pos lie in that page before the end of the file, 0 at the end
+ * (with nothing pinned), or -errno. The length is read and the page
+ * looked up under vn_mutex, as s5fs_read does, so that a write or
+ * truncate going on meanwhile is not seen halfway. The lock is dropped
+ * before returning, since the caller's copy may fault on a mapping of
+ * the same file, or write to it. The caller unpins the page.
+ */
+int
+vnode_pin_page(vnode_t *vn, off_t pos, size_t len, pframe_t **pfp)
+{
+        uint32_t n;
+        int ret;
+
+        KASSERT(S_ISREG(vn->vn_mode));
+
+        kmutex_lock(&vn->vn_mutex);
+        if (pos >= vn->vn_len) {
+                kmutex_unlock(&vn->vn_mutex);
+                return 0;
+        }
+        n = MIN(len, PAGE_SIZE - (uint32_t)pos % PAGE_SIZE);
+        n = MIN(n, (uint32_t)(vn->vn_len - pos));
+        if (0 <= (ret = pframe_get(&vn->vn_mmobj, pos / PAGE_SIZE, pfp))) {
+                pframe_pin(*pfp);
+                ret = (int)n;
+        }
+        kmutex_unlock(&vn->vn_mutex);
+        return ret;
 }
 
 static void
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "types.h"
+
+struct proc;
+
+/*
+ * I/O submission ring. ring_setup maps one page shared between a process
+ * and the kernel, laid out as an ioring_map_t. The process fills
+ * submission entries and moves ih_sq_tail past them; ring_enter hands
+ * them to the ring worker, a kernel thread which carries them out in
+ * batches and posts a completion entry for each, moving ih_cq_tail. The
+ * process consumes completions and moves ih_cq_head.
+ *
+ * Reads of character devices which may wait for input (anything but
+ * /dev/null and /dev/zero) complete with -EAGAIN: the single worker
+ * serves every ring and must not sleep on one of them indefinitely.
+ *
+ * Head and tail indices run freely; the slot of index i is i modulo the
+ * number of entries. The kernel only writes ih_sq_head and ih_cq_tail,
+ * the process only ih_sq_tail and ih_cq_head.
+ */
+#define IORING_SQ_ENTRIES 64
+#define IORING_CQ_ENTRIES 128
+
+/* most entries the worker carries out before posting a wakeup */
+#define IORING_BATCH      16
+
+#define IORING_OP_READ    1
+#define IORING_OP_WRITE   2
+#define IORING_OP_OPEN    3     /* path in sqe_buf, flags in sqe_len */
+#define IORING_OP_CLOSE   4
+#define IORING_OP_FSYNC   5
+
+typedef struct ioring_sqe {
+        uint8_t   sqe_op;
+        uint8_t   sqe_pad[3];
+        int       sqe_fd;
+        void     *sqe_buf;
+        uint32_t  sqe_len;
+        off_t     sqe_off;      /* -1 to use and advance the file position */
+        uint32_t  sqe_data;     /* copied into the completion */
+} ioring_sqe_t;
+
+typedef struct ioring_cqe {
+        uint32_t  cqe_data;
+        int       cqe_res;      /* what the call would return, or -errno */
+} ioring_cqe_t;
+
+typedef struct ioring_map {
+        uint32_t      ih_sq_head;
+        uint32_t      ih_sq_tail;
+        uint32_t      ih_cq_head;
+        uint32_t      ih_cq_tail;
+        ioring_sqe_t  ih_sq[IORING_SQ_ENTRIES];
+        ioring_cqe_t  ih_cq[IORING_CQ_ENTRIES];
+} ioring_map_t;
+
+extern uint32_t ioring_nenters;   /* ring_enter calls */
+extern uint32_t ioring_nops;      /* entries carried out */
+extern uint32_t ioring_nbatches;  /* worker batches */
+
+int  ioring_setup(void **uaddrp);
+int  ioring_enter(uint32_t to_submit, uint32_t min_complete);
+void ioring_destroy(struct proc *p);
+void ioring_shutdown(void);
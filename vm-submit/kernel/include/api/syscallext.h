@@ -0,0 +1,80 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * System calls added on top of the ones in api/syscall.h. Numbers start
+ * at 60 to stay clear of the stock table.
+ */
+
+#define SYS_madvise     60
+#define SYS_mremap      61
+#define SYS_readv       62
+#define SYS_writev      63
+#define SYS_pread       64
+#define SYS_pwrite      65
+#define SYS_getcwd      66
+#define SYS_sendfile    67
+#define SYS_copy_file_range 68
+#define SYS_ring_setup  69
+#define SYS_ring_enter  70
+
+/* most segments a single readv or writev takes */
+#define UIO_MAXIOV      64
+
+typedef struct madvise_args {
+        void    *mad_addr;
+        size_t   mad_len;
+        int      mad_advice;
+} madvise_args_t;
+
+typedef struct mremap_args {
+        void    *mra_addr;
+        size_t   mra_oldlen;
+        size_t   mra_newlen;
+        int      mra_flags;
+} mremap_args_t;
+
+struct iovec {
+        void    *iov_base;
+        size_t   iov_len;
+};
+
+typedef struct rwv_args {
+        int                  rwv_fd;
+        const struct iovec  *rwv_iov;
+        int                  rwv_iovcnt;
+} rwv_args_t;
+
+typedef struct prw_args {
+        int      prw_fd;
+        void    *prw_buf;
+        size_t   prw_nbytes;
+        off_t    prw_offset;
+} prw_args_t;
+
+typedef struct getcwd_args {
+        char    *gcwd_buf;
+        size_t   gcwd_size;
+} getcwd_args_t;
+
+typedef struct sendfile_args {
+        int      sf_outfd;
+        int      sf_infd;
+        off_t   *sf_offset;     /* NULL to use and advance in's position */
+        size_t   sf_count;
+} sendfile_args_t;
+
+typedef struct cfr_args {
+        int       cfr_infd;
+        off_t    *cfr_inoff;    /* NULL to use and advance the position */
+        int       cfr_outfd;
+        off_t    *cfr_outoff;
+        size_t    cfr_len;
+        unsigned  cfr_flags;    /* must be 0 */
+} cfr_args_t;
+
+typedef struct ring_enter_args {
+        uint32_t re_to_submit;
+        uint32_t re_min_complete;
+} ring_enter_args_t;
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+struct pframe;
+
+/*
+ * copy_from_user and copy_to_user first try to copy straight to or from
+ * the pages backing the user range, through their kernel addresses, and
+ * only fall back to vmmap_read/vmmap_write (which may block) for what is
+ * left once they reach a page which is not resident, or which a write
+ * would first have to fault to copy or dirty.
+ */
+extern uint32_t uaccess_nfast;   /* copies done entirely on the fast path */
+extern uint32_t uaccess_nslow;   /* copies that fell back to the vmmap */
+
+/* vm/pagefault.c */
+struct pframe *pagefault_peek(struct vmarea *vma, uint32_t vfn, int forwrite);
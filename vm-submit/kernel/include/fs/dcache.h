@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+
+struct fs;
+struct vnode;
+
+/*
+ * Directory name cache. lookup() remembers, for a directory and a name
+ * in it, the inode the name refers to, or that there is no such name
+ * (a negative entry). Entries do not hold references; a hit gets the
+ * vnode with vget, which finds it in the vnode cache.
+ *
+ * Operations which add or remove names purge the entries for them. A
+ * lookup which went to the fs may have slept while a purge ran, so
+ * callers snapshot dcache_npurges before asking the fs and only enter
+ * the result if it did not change.
+ *
+ * Path resolution walks the directories it only passes through by inode
+ * number with dcache_walk, taking no references, and checks that
+ * dcache_seq did not change (no entry was purged or replaced) before it
+ * trusts the result; see dir_namev. getcwd goes the other way, from a
+ * directory to its parent, with dcache_parent.
+ */
+#define DCACHE_NENTRIES  512
+#define DCACHE_HASH_SIZE 128
+
+extern int      dcache_enabled;     /* tunable; 0 bypasses the cache */
+extern uint32_t dcache_nhits;       /* lookups answered with a vnode */
+extern uint32_t dcache_nneg_hits;   /* lookups answered with ENOENT */
+extern uint32_t dcache_nmisses;     /* lookups which went to the fs */
+extern uint32_t dcache_nentries;
+extern uint32_t dcache_seq;         /* bumped whenever an entry goes away */
+extern uint32_t dcache_npurges;     /* bumped by every purge, hit or not */
+extern uint32_t dcache_nwalked;     /* components walked without a reference */
+extern uint32_t dcache_nretries;    /* walks redone after dcache_seq changed */
+extern uint32_t dcache_nparents;    /* getcwd steps answered from the cache */
+extern uint32_t dcache_nparent_misses;
+
+/* 0 with a referenced vnode in *result, -ENOENT, or DCACHE_MISS */
+#define DCACHE_MISS 1
+int  dcache_lookup(struct vnode *dir, const char *name, size_t len, struct vnode **result);
+void dcache_enter(struct vnode *dir, const char *name, size_t len, struct vnode *child);
+void dcache_purge(struct vnode *dir, const char *name, size_t len);
+void dcache_purge_fs(struct fs *fs);
+int  dcache_walk(struct fs *fs, ino_t dir, const char *name, size_t len, ino_t *child);
+int  dcache_parent(struct fs *fs, ino_t ino, ino_t *parent, const char **name, size_t *len);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.h"
+
+struct proc;
+struct file;
+
+/*
+ * File descriptor table bitmap. Each process keeps one bit per slot of
+ * p_files, set while the slot holds a file, so that get_empty_fd finds
+ * the lowest free descriptor a word at a time and fork, exit and dup
+ * visit only the open ones. It lives in proc.c's wrapper around proc_t
+ * (see proc/procstat.h); proc_fdmap() returns it.
+ *
+ * p_files itself is a fixed array of NFILES slots in proc_t, so the
+ * table does not grow past NFILES.
+ *
+ * Every change to p_files goes through fd_install and fd_clear, which
+ * keep the two in step.
+ */
+#define FD_NWORDS ((NFILES + 31) / 32)
+
+uint32_t    *proc_fdmap(struct proc *p);
+
+void         fd_install(struct proc *p, int fd, struct file *f);
+struct file *fd_clear(struct proc *p, int fd);
+int          fd_next(struct proc *p, int fd);
+int          fd_count(struct proc *p);
+
+int          do_open_in(struct proc *p, const char *filename, int oflags);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Vnode cache. Vnodes in use are found through a hash table keyed on
+ * (fs, vno) instead of a scan of every vnode in the system, and each
+ * file system's vnodes are also kept on a list of their own for the
+ * walks made when it is unmounted or synced.
+ */
+#define VNODE_HASH_SIZE 256
+#define VNODE_MAXFS     16    /* file systems with vnodes at the same time */
+
+extern uint32_t vnode_nlookups;   /* vget calls */
+extern uint32_t vnode_nhits;      /* vget calls which found the vnode */
+extern uint32_t vnode_nprobes;    /* vnodes compared by vget */
+extern uint32_t vnode_ncount;     /* vnodes allocated */
+
+/*
+ * Unreferenced vnodes of files which still exist are kept on an LRU list
+ * of inactive vnodes, so that opening the file again finds the vnode
+ * without reading the inode back in.
+ */
+#define VNODE_INACTIVE_MAX 128
+
+struct fs;
+
+extern int      vnode_inactive_max;  /* tunable; 0 turns the cache off */
+extern uint32_t vnode_ninactive;     /* vnodes on the inactive list */
+extern uint32_t vnode_nrevived;      /* vget calls which revived one */
+extern uint32_t vnode_nread;         /* vget calls which read the inode */
+extern uint32_t vnode_nevicted;      /* inactive vnodes deleted */
+
+int vnode_inactive_trim(struct fs *fs, int n);
+
+/*
+ * Reads of regular files which copy straight out of the page cache
+ * (read, sendfile, copy_file_range, ring reads) get each page through
+ * vnode_pin_page, which honours the file system's locking and the end
+ * of the file as its read would.
+ */
+struct vnode;
+struct pframe;
+
+int vnode_pin_page(struct vnode *vn, off_t pos, size_t len, struct pframe **pfp);
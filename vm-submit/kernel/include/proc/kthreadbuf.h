@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.h"
+
+struct kthread;
+
+/*
+ * A page per thread for staging read and write data between user space
+ * and devices, so that a system call needs no heap memory proportional
+ * to its size. kthread.c keeps it in a wrapper around kthread_t (see
+ * proc/procstat.h). The page itself is allocated on first use and
+ * freed with the thread.
+ */
+void *kthread_bounce_page(struct kthread *thr);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "types.h"
+
+struct proc;
+
+/*
+ * Per-process counters.
+ *
+ * They are the first state added to proc_t without changing proc_t
+ * itself. Instead, proc.c's allocator hands out a wrapper structure,
+ * proc_ext_t, which holds the proc_t and the added fields, and gets
+ * back from a proc_t to its wrapper with CONTAINER_OF. Only proc.c
+ * knows the wrapper; everything else goes through an accessor such as
+ * proc_stats(). kthread_t, vnode_t, vmarea_t and vmmap_t are extended
+ * the same way in the files which allocate them.
+ */
+typedef struct proc_stat {
+        uint32_t ps_nfaults;      /* page faults handled */
+        uint32_t ps_nfaultaround; /* extra pages mapped by fault-around */
+} proc_stat_t;
+
+/* sums of the counters of all processes which have been reaped */
+extern proc_stat_t proc_stats_exited;
+
+proc_stat_t *proc_stats(struct proc *p);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+
+/*
+ * pf_flags bit set by pframe_alloc when the page frame was taken from the
+ * pre-zeroed pool; anon_fillpage clears it instead of zeroing the page.
+ */
+#define PF_ZEROED 0x10
+
+#define pframe_is_zeroed(pf)     ((pf)->pf_flags & PF_ZEROED)
+#define pframe_set_zeroed(pf)    ((pf)->pf_flags |= PF_ZEROED)
+#define pframe_clear_zeroed(pf)  ((pf)->pf_flags &= ~PF_ZEROED)
+
+/* number of pre-zeroed page frames kept around by the idle loop */
+#define ANON_ZEROPOOL_SIZE 32
+/* do not grow the pool once the system is down to this many free pages */
+#define ANON_ZEROPOOL_MINFREE 256
+
+extern uint32_t anon_zeropool_hits;
+extern uint32_t anon_zeropool_misses;
+/* read faults satisfied by mapping the shared zero page */
+extern uint32_t anon_zeropage_faults;
+
+int   mmobj_is_anon(struct mmobj *o);
+
+void *anon_zeropage(void);
+
+void *anon_zeropool_take(void);
+int   anon_zeropool_refill(void);
+void  anon_zeropool_drain(void);
+int   anon_zeropool_count(void);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * When the heap shrinks, brk keeps up to brk_reserve_max pages above
+ * the new break in the heap area, unmapped but resident, so that a heap
+ * which shrinks and grows around the same boundary does not tear down
+ * and rebuild its area and pages each time; a grow into the reserve
+ * clears its pages in place. The reserve is given back when memory runs
+ * low: pageoutd frees its pages (brk_reserve_reclaim), and the process
+ * cuts the area down at its next brk or page fault.
+ */
+#define BRK_RESERVE_MAX 64
+
+extern uint32_t brk_reserve_max;      /* tunable, BRK_RESERVE_MAX by default */
+
+extern uint32_t brk_ncalls;           /* do_brk calls which set the break */
+extern uint32_t brk_nreserve_hits;    /* grows served from the reserve */
+extern uint32_t brk_nreserve_kept;    /* shrinks which only moved the break */
+extern uint32_t brk_npages_released;  /* heap pages given back */
+extern uint32_t brk_npages_reclaimed; /* reserve pages freed by pageoutd */
+
+struct vmarea;
+
+void brk_release_reserve(void);
+int  brk_reserve_reclaim(void);
+int  brk_in_reserve(struct vmarea *vma, uint32_t vfn);
+
+/* mm/pframe.c: 1 when free memory is below what pageoutd aims for */
+int pframe_memory_low(void);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Large fault-around window.
+ *
+ * With LARGEMAP enabled, a read fault on a page which was resident
+ * already (a minor fault) maps the resident pages of the whole
+ * 4MB-aligned window around it, rather than those of the small
+ * fault-around window, when the area's objects hold more pages than
+ * the small window would cover. Pages are mapped with ordinary 4KB
+ * entries as pagefault_map_resident would: the page table code has no
+ * large page entries, so this saves faults but not TLB entries, and
+ * nothing has to be undone when part of the window goes away.
+ */
+#define LARGEMAP_NPAGES   1024   /* 4MB */
+
+/* pages entered by the large window besides the faulting one; a page
+ * the process had mapped already is entered (and counted) again */
+extern uint32_t largemap_nahead;
+
+int  largemap_enabled(void);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+struct pframe;
+
+/* do_mmap flag: fault in and map the whole mapping up front */
+#define MAP_POPULATE    0x10
+
+/* madvise(2) advice values */
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1  /* no fault-around */
+#define MADV_SEQUENTIAL 2  /* read ahead, reclaim pages behind the scan first */
+#define MADV_WILLNEED   3  /* start reading the range in the background */
+#define MADV_DONTNEED   4  /* drop the range's mappings and private pages now */
+
+int do_madvise(void *addr, size_t len, int advice);
+/* MADV_DONTNEED on pages [lopage, hipage) of one area, TLB flush counted
+ * against cause (see vm/tlbflush.h) */
+void madvise_dontneed(struct vmarea *vma, uint32_t lopage, uint32_t hipage, int cause);
+/* make pages [lopage, hipage) of a private area read as zeroes */
+int  madvise_zero(struct vmarea *vma, uint32_t lopage, uint32_t hipage);
+
+/* vm/pagefault.c */
+int pagefault_populate(struct vmarea *vma, uint32_t lopage, uint32_t npages);
+
+/* mm/pframe.c */
+void pframe_deactivate(struct pframe *pf);
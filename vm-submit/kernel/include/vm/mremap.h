@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+struct vmarea;
+
+/* mremap(2) flag: the mapping may be moved if it cannot grow in place */
+#define MREMAP_MAYMOVE  1
+
+int do_mremap(void *oldaddr, size_t oldlen, size_t newlen, int flags, void **ret);
+
+/* vm/pagefault.c: maps the page backing vfn if it is resident already */
+int pagefault_map_resident(struct vmarea *vma, uint32_t vfn);
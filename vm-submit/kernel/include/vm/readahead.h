@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+
+/* pages read ahead of a sequential fault */
+#define READAHEAD_WINDOW     16
+/* pending requests; more are dropped, readahead is only a hint */
+#define READAHEAD_QUEUE_SIZE 32
+/* do not read ahead once the system is down to this many free pages */
+#define READAHEAD_MINFREE    256
+
+extern uint32_t readahead_nqueued;
+extern uint32_t readahead_ndropped;
+extern uint32_t readahead_npages;  /* pages brought in by readaheadd */
+
+void readahead(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+void readahead_shutdown(void);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+struct pframe;
+
+/*
+ * Anonymous and shadow pages are paged out to the second disk; the
+ * first one holds the root file system. Each slot is one block, and
+ * blocks are the size of a page.
+ */
+#define SWAP_DEVID  MKDEVID(1, 1)
+#define SWAP_NSLOTS 24576
+
+#define SWAP_HASH_SIZE 1024
+
+extern uint32_t swap_nout;       /* pages written to swap */
+extern uint32_t swap_nin;        /* pages read back from swap */
+extern uint32_t swap_nslots_used;
+
+void swap_init(void);
+int  swap_enabled(void);
+
+int  swap_out(struct pframe *pf);
+int  swap_in(struct pframe *pf);
+int  swap_has(struct mmobj *o, uint32_t pagenum);
+int  swap_has_range(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+void swap_drop_range(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+void swap_drop_obj(struct mmobj *o);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Batched TLB invalidation for changes to the current address space.
+ *
+ * Code which unmaps user pages queues the ranges it actually unmapped
+ * in a tlb_batch_t and calls tlb_batch_finish() when done. A small
+ * batch is invalidated page by page with invlpg; a batch of more than
+ * TLB_FLUSH_MAXPAGES pages (or more ranges than fit) flushes the whole
+ * TLB instead, which is cheaper than that many invlpgs. An empty batch
+ * does not touch the TLB at all.
+ */
+
+#define TLB_FLUSH_MAXPAGES 32
+#define TLB_BATCH_RANGES   8
+
+/* why the batch was started; flushes are counted separately for each */
+#define TLB_MUNMAP   0
+#define TLB_MMAP     1
+#define TLB_BRK      2
+#define TLB_FORK     3
+#define TLB_MADVISE  4
+#define TLB_MREMAP   5
+#define TLB_NCAUSES  6
+
+typedef struct tlb_batch {
+        int          tb_cause;
+        uint32_t     tb_npages;
+        uint32_t     tb_nranges;
+        uintptr_t    tb_start[TLB_BATCH_RANGES];
+        uint32_t     tb_len[TLB_BATCH_RANGES];
+} tlb_batch_t;
+
+typedef struct tlb_stat {
+        uint32_t     ts_nbatches;   /* batches finished */
+        uint32_t     ts_nempty;     /* ... which had nothing to invalidate */
+        uint32_t     ts_ninvlpg;    /* pages invalidated one by one */
+        uint32_t     ts_nfull;      /* whole TLB flushes */
+} tlb_stat_t;
+
+extern tlb_stat_t  tlb_stats[TLB_NCAUSES];
+extern const char *tlb_cause_name[TLB_NCAUSES];
+
+void tlb_batch_init(tlb_batch_t *tb, int cause);
+void tlb_batch_add(tlb_batch_t *tb, uintptr_t vaddr, uint32_t npages);
+void tlb_batch_finish(tlb_batch_t *tb);
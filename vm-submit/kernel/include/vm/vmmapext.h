@@ -0,0 +1,52 @@
+#pragma once
+
+#include "types.h"
+
+struct vmmap;
+struct vmarea;
+struct tlb_batch;
+
+/*
+ * Additions to the vmmap interface.
+ *
+ * vmmap keeps its areas in a balanced tree as well as in vmm_list.
+ * Code which moves the start or end of an area in place (without
+ * overlapping a neighbour) must call vmmap_area_resized() afterwards
+ * so the tree stays consistent.
+ */
+void vmmap_area_resized(struct vmmap *map, struct vmarea *vma);
+
+/*
+ * The fault handler reports the pages it maps with vmarea_mapped();
+ * vmarea_unmap() then only walks the page table (and queues TLB
+ * invalidations) for pages which may actually be mapped.
+ * vmmap_remove_cause() is vmmap_remove() with the TLB flush counted
+ * against one of the TLB_* causes of vm/tlbflush.h.
+ */
+void vmarea_mapped(struct vmarea *vma, uint32_t lopage, uint32_t hipage);
+void vmarea_unmap(struct vmarea *vma, uint32_t lopage, uint32_t hipage,
+                  struct tlb_batch *tb);
+int  vmmap_remove_cause(struct vmmap *map, uint32_t lopage, uint32_t npages, int cause);
+
+/*
+ * for mremap: split off a range as an area of its own, move an area,
+ * tell whether an area may grow over the object pages after it, and
+ * map what lies after an area which may not as a new area
+ */
+struct vmarea *vmmap_isolate(struct vmmap *map, uint32_t lopage, uint32_t hipage);
+void vmmap_move(struct vmmap *map, struct vmarea *vma, uint32_t newlo, uint32_t npages);
+int  vmmap_area_growable(struct vmarea *vma, uint32_t npages);
+int  vmmap_map_past(struct vmmap *map, struct vmarea *vma, uint32_t lopage, uint32_t npages);
+
+struct vmarea *vmmap_heap(struct vmmap *map);
+void vmmap_set_heap(struct vmmap *map, struct vmarea *vma);
+
+int  vmarea_advice(struct vmarea *vma);
+void vmarea_set_advice(struct vmarea *vma, int advice);
+
+struct vmarea *vmmap_extend_anon(struct vmmap *map, uint32_t lopage, uint32_t npages,
+                                 int prot, int flags);
+
+/* vmmap_lookup calls, and how many were answered by the last-area cache */
+extern uint32_t vmmap_lookups;
+extern uint32_t vmmap_lookup_hits;
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Compressed in-memory page store, used by swap as a reclaim tier in
+ * front of the swap disk. Pages are compressed with a small LZSS
+ * compressor and kept in size-class slab allocators.
+ */
+
+/* pages which do not compress below this many bytes go to disk instead */
+#define ZPOOL_MAX_OBJSIZE 3072
+/* upper bound on the memory (in bytes) held by compressed pages */
+#define ZPOOL_MAX_BYTES   (8 * 1024 * 1024)
+
+extern uint32_t zpool_nstored;      /* pages currently held */
+extern uint32_t zpool_comp_bytes;   /* compressed bytes currently held */
+extern uint32_t zpool_alloc_bytes;  /* bytes allocated for them (size-class rounded) */
+extern uint32_t zpool_nrejected;    /* pages that did not compress well enough */
+extern uint32_t zpool_nhits;        /* faults satisfied from the pool */
+extern uint32_t zpool_hit_cycles;   /* running average of cycles per hit */
+
+void  zpool_init(void);
+int   zpool_enabled(void);
+
+void *zpool_store(const void *page, uint32_t *lenp);
+int   zpool_load(const void *zdata, uint32_t len, void *page);
+void  zpool_free(void *zdata, uint32_t len);
@@ -15,10 +15,28 @@
 #include "mm/pagetable.h"
 #include "mm/pframe.h"
 #include "mm/slab.h"
+#include "mm/mmobj.h"
+#include "mm/mman.h"
 
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/anon.h"
+#include "vm/anonmem.h"
+#include "vm/swap.h"
+#include "vm/zpool.h"
+#include "vm/vmmapext.h"
+#include "vm/readahead.h"
+#include "vm/tlbflush.h"
+#include "vm/brk.h"
+#include "vm/brkheap.h"
+#include "vm/mremap.h"
+#include "vm/largemap.h"
+#include "vm/pagefault.h"
+#include "api/uaccess.h"
+#include "api/ioring.h"
+#include "fs/vcache.h"
+#include "fs/dcache.h"
+#include "vm/mmap.h"
 
 #include "main/acpi.h"
 #include "main/apic.h"
@@ -29,6 +47,7 @@
 #include "proc/sched.h"
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/procstat.h"
 
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
@@ -41,6 +60,7 @@
 #include "fs/vnode.h"
 #include "fs/vfs_syscall.h"
 #include "fs/fcntl.h"
+#include "fs/lseek.h"
 #include "fs/stat.h"
 
 #include "test/kshell/kshell.h"
@@ -242,6 +262,13 @@ idleproc_run(int arg1, void *arg2)
 	kthread_reapd_shutdown();
 #endif
 
+#ifdef __VM__
+	/* queued readahead requests hold references on file objects */
+	readahead_shutdown();
+	/* every process, and with it every ring, is gone by now */
+	ioring_shutdown();
+#endif
+
 
 #ifdef __VFS__
 	/* Shutdown the vfs: */
@@ -401,6 +428,687 @@ static int edTest (kshell_t *k, int argc1, char **argv1)
   return 0;
 }
 
+static int vmstatTest (kshell_t *k, int argc1, char **argv1)
+{
+  kprintf(k, "zero pool:      %d/%d pages\n", anon_zeropool_count(), ANON_ZEROPOOL_SIZE);
+  kprintf(k, "zero pool hits: %u\n", anon_zeropool_hits);
+  kprintf(k, "zero pool miss: %u\n", anon_zeropool_misses);
+  kprintf(k, "zero page maps: %u\n", anon_zeropage_faults);
+  kprintf(k, "swap out/in:    %u/%u pages\n", swap_nout, swap_nin);
+  kprintf(k, "swap slots:     %u/%u used\n", swap_nslots_used, SWAP_NSLOTS);
+  kprintf(k, "vma lookups:    %u, %u hit the last-area cache\n", vmmap_lookups, vmmap_lookup_hits);
+  kprintf(k, "readahead:      %u requests, %u dropped, %u pages read\n",
+          readahead_nqueued, readahead_ndropped, readahead_npages);
+  kprintf(k, "brk:            %u calls, %u shrinks kept a reserve, %u grows reused it, %u pages released,"
+          " %u reclaimed by pageoutd\n",
+          brk_ncalls, brk_nreserve_kept, brk_nreserve_hits, brk_npages_released, brk_npages_reclaimed);
+  kprintf(k, "large window:   %u pages mapped ahead\n", largemap_nahead);
+  kprintf(k, "user copies:    %u direct, %u through the vmmap\n", uaccess_nfast, uaccess_nslow);
+
+  int i;
+  for(i = 0; i < TLB_NCAUSES; i++){
+    kprintf(k, "tlb %-11s %u unmaps (%u needed no flush), %u pages invlpg'd, %u full flushes\n",
+            tlb_cause_name[i], tlb_stats[i].ts_nbatches, tlb_stats[i].ts_nempty,
+            tlb_stats[i].ts_ninvlpg, tlb_stats[i].ts_nfull);
+  }
+
+  proc_t* p = NULL;
+  list_iterate_begin(proc_list(), p, proc_t, p_list_link){
+    kprintf(k, "pid %3d %-13s %u faults, %u pages mapped around\n", p->p_pid, p->p_comm,
+            proc_stats(p)->ps_nfaults, proc_stats(p)->ps_nfaultaround);
+  }list_iterate_end();
+  kprintf(k, "%-21s %u faults, %u pages mapped around\n", "exited",
+          proc_stats_exited.ps_nfaults, proc_stats_exited.ps_nfaultaround);
+  return 0;
+}
+
+/*
+ * Compressed page pool statistics. The ratio is printed in tenths:
+ * original page bytes over compressed bytes held.
+ */
+static int zramstatTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t ratio = 0;
+
+  if(!zpool_enabled())
+    {
+      kprintf(k, "compressed pool is not enabled (ZRAM=1 is needed)\n");
+      return 0;
+    }
+  if(0 < zpool_comp_bytes)
+    ratio = (zpool_nstored * PAGE_SIZE) / (zpool_comp_bytes / 10 + 1);
+
+  kprintf(k, "pages stored:   %u\n", zpool_nstored);
+  kprintf(k, "compressed:     %u bytes (%u allocated, limit %u)\n",
+          zpool_comp_bytes, zpool_alloc_bytes, ZPOOL_MAX_BYTES);
+  kprintf(k, "ratio:          %u.%u\n", ratio / 10, ratio % 10);
+  kprintf(k, "rejected:       %u pages\n", zpool_nrejected);
+  kprintf(k, "faults served:  %u (avg %u cycles to decompress)\n", zpool_nhits, zpool_hit_cycles);
+  return 0;
+}
+
+/*
+ * File system cache statistics. The chain length is printed in tenths:
+ * vnodes compared per vget.
+ */
+static int vfsstatTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t chain = 0;
+
+  if(0 < vnode_nlookups)
+    chain = (vnode_nprobes * 10) / vnode_nlookups;
+
+  kprintf(k, "vnodes:         %u allocated\n", vnode_ncount);
+  kprintf(k, "vget:           %u calls, %u found the vnode, %u.%u compared per call\n",
+          vnode_nlookups, vnode_nhits, chain / 10, chain % 10);
+  kprintf(k, "inactive:       %u/%d vnodes kept, %u revived, %u inodes read, %u deleted\n",
+          vnode_ninactive, vnode_inactive_max, vnode_nrevived, vnode_nread, vnode_nevicted);
+  kprintf(k, "name cache:     %u/%d entries, %u hits, %u negative hits, %u misses\n",
+          dcache_nentries, DCACHE_NENTRIES, dcache_nhits, dcache_nneg_hits, dcache_nmisses);
+  kprintf(k, "path walk:      %u directories passed without a reference, %u walks redone\n",
+          dcache_nwalked, dcache_nretries);
+  kprintf(k, "getcwd:         %u parents found in the cache, %u looked up\n",
+          dcache_nparents, dcache_nparent_misses);
+  return 0;
+}
+
+/*
+ * Memory overcommit stress test for swap: dirties three times as many
+ * anonymous pages as there are free page frames, then reads all of them
+ * back and checks their contents. Optional argument: number of pages.
+ */
+static int swapTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t npages = 3 * page_free_count();
+  uint32_t i = 0;
+  uint32_t nbad = 0;
+  pframe_t* pf = NULL;
+  mmobj_t* obj = NULL;
+
+  if(!swap_enabled())
+    {
+      kprintf(k, "swap is not enabled (ZRAM=1, or SWAP=1 and a second disk, are needed)\n");
+      return 0;
+    }
+  if(1 < argc1)
+    npages = strtol(argv1[1], NULL, 10);
+  if(SWAP_NSLOTS < npages)
+    npages = SWAP_NSLOTS;
+
+  obj = anon_create();
+  if(NULL == obj)
+    return -ENOMEM;
+
+  kprintf(k, "writing %u pages (%u free)\n", npages, page_free_count());
+  for(i = 0; i < npages; i++)
+    {
+      if(0 > pframe_get(obj, i, &pf))
+        break;
+      pframe_dirty(pf);
+      ((uint32_t *)pf->pf_addr)[0] = i;
+      ((uint32_t *)pf->pf_addr)[PAGE_SIZE / sizeof(uint32_t) - 1] = ~i;
+    }
+  npages = i;
+
+  kprintf(k, "verifying %u pages\n", npages);
+  for(i = 0; i < npages; i++)
+    {
+      if((0 > pframe_get(obj, i, &pf))
+         || (i != ((uint32_t *)pf->pf_addr)[0])
+         || (~i != ((uint32_t *)pf->pf_addr)[PAGE_SIZE / sizeof(uint32_t) - 1]))
+        nbad++;
+    }
+
+  obj->mmo_ops->put(obj);
+  kprintf(k, "%u pages bad, %u swapped out, %u swapped in\n", nbad, swap_nout, swap_nin);
+  return 0;
+}
+
+/*
+ * Scans vmm_list for the first (or, with hilo set, last) gap of npages,
+ * the way vmmap_find_range used to. Reference for vmmapTest.
+ */
+static int vmmapScanRange (vmmap_t *map, uint32_t npages, int hilo)
+{
+  vmarea_t* vma = NULL;
+  uint32_t lo = ADDR_TO_PN(USER_MEM_LOW);
+  int found = -1;
+
+  list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink){
+    if(npages <= vma->vma_start - lo)
+      {
+        if(!hilo)
+          return lo;
+        found = vma->vma_start - npages;
+      }
+    lo = vma->vma_end;
+  }list_iterate_end();
+  if(npages <= ADDR_TO_PN(USER_MEM_HIGH) - lo)
+    found = ADDR_TO_PN(USER_MEM_HIGH) - npages;
+  return found;
+}
+
+/*
+ * vmmap tree test: maps n one-page areas with a hole after each into a
+ * scratch vmmap, unmaps every third one, then checks vmmap_lookup,
+ * vmmap_is_range_empty and vmmap_find_range against scans of vmm_list.
+ * Optional argument: number of areas.
+ */
+static int vmmapTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t n = 2000;
+  uint32_t i = 0;
+  uint32_t vfn = 0;
+  uint32_t nbad = 0;
+  uint32_t base = ADDR_TO_PN(USER_MEM_LOW);
+  vmarea_t* vma = NULL;
+  vmarea_t* scan = NULL;
+  vmmap_t* map = vmmap_create();
+
+  if(1 < argc1)
+    n = strtol(argv1[1], NULL, 10);
+  if(n > (ADDR_TO_PN(USER_MEM_HIGH) - base) / 2 - 1)
+    n = (ADDR_TO_PN(USER_MEM_HIGH) - base) / 2 - 1;
+
+  for(i = 0; i < n; i++)
+    {
+      if(0 > vmmap_map(map, NULL, base + 2 * i, 1, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, 0, VMMAP_DIR_LOHI, NULL))
+        break;
+    }
+  n = i;
+  for(i = 0; i < n; i += 3)
+    vmmap_remove(map, base + 2 * i, 1);
+
+  for(vfn = base; vfn < base + 2 * n + 2; vfn++)
+    {
+      scan = NULL;
+      list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink){
+        if((vma->vma_start <= vfn) && (vfn < vma->vma_end))
+          scan = vma;
+      }list_iterate_end();
+      if((scan != vmmap_lookup(map, vfn))
+         || ((NULL == scan) != vmmap_is_range_empty(map, vfn, 1)))
+        nbad++;
+    }
+  for(i = 1; i <= 4; i++)
+    {
+      if(vmmapScanRange(map, i, 0) != vmmap_find_range(map, i, VMMAP_DIR_LOHI))
+        nbad++;
+      if(vmmapScanRange(map, i, 1) != vmmap_find_range(map, i, VMMAP_DIR_HILO))
+        nbad++;
+    }
+
+  vmmap_destroy(map);
+  kprintf(k, "%u areas, %u mismatches\n", n - (n + 2) / 3, nbad);
+  return 0;
+}
+
+static inline uint32_t brkbenchRdtsc (void)
+{
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return lo;
+}
+
+/* results of the brkbench process, one per reserve setting */
+static uint32_t brkbenchCycles[2];
+static uint32_t brkbenchStale;
+static int brkbenchErr;
+
+/*
+ * Body of the brkbench process: moves its break up and down by half of
+ * npages (arg2) around a fixed boundary niters (arg1) times, writing to
+ * each page it grows into, once with the reserve off and once with it
+ * on. Counts the pages grown into which did not read as zeroes. The
+ * process has no userland image, so the heap is placed by hand.
+ */
+static void *brkbenchRun (int arg1, void *arg2)
+{
+  uint32_t niters = (uint32_t)arg1;
+  uint32_t npages = (uint32_t)arg2;
+  uint32_t base = (uint32_t)PN_TO_ADDR(ADDR_TO_PN(USER_MEM_LOW) + 1024);
+  uint32_t top = base + npages * PAGE_SIZE;
+  uint32_t mid = top - (npages / 2) * PAGE_SIZE;
+  uint32_t i = 0, va = 0, start = 0, word = 0;
+  int pass = 0;
+  void *ret = NULL;
+
+  curproc->p_start_brk = (void *)base;
+  curproc->p_brk = (void *)base;
+  for(pass = 0; pass < 2; pass++)
+    {
+      brk_reserve_max = pass ? BRK_RESERVE_MAX : 0;
+      brkbenchCycles[pass] = 0;
+      if(0 > (brkbenchErr = do_brk((void *)top, &ret)))
+        break;
+      for(i = 0; i < niters; i++)
+        {
+          start = brkbenchRdtsc();
+          do_brk((void *)mid, &ret);
+          do_brk((void *)top, &ret);
+          for(va = mid; va < top; va += PAGE_SIZE)
+            {
+              vmmap_read(curproc->p_vmmap, (void *)va, &word, sizeof(word));
+              if(0 != word)
+                brkbenchStale++;
+              word = i + 1;
+              vmmap_write(curproc->p_vmmap, (void *)va, &word, sizeof(word));
+            }
+          brkbenchCycles[pass] += brkbenchRdtsc() - start;
+        }
+      do_brk((void *)base, &ret);
+    }
+  brk_reserve_max = BRK_RESERVE_MAX;
+  return NULL;
+}
+
+/*
+ * brk microbenchmark: runs brkbenchRun in a new process and prints the
+ * average cycles per shrink/grow/touch round with and without the heap
+ * reserve. Optional arguments: number of rounds, heap size in pages.
+ */
+static int brkbenchTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t niters = 1000;
+  uint32_t npages = 32;
+  uint32_t kept = brk_nreserve_kept;
+  uint32_t hits = brk_nreserve_hits;
+
+  if(1 < argc1)
+    niters = strtol(argv1[1], NULL, 10);
+  if(2 < argc1)
+    npages = strtol(argv1[2], NULL, 10);
+  if((0 == niters) || (2 > npages) || (2 * BRK_RESERVE_MAX < npages))
+    {
+      kprintf(k, "usage: brkbench [rounds] [pages, 2 to %d]\n", 2 * BRK_RESERVE_MAX);
+      return 0;
+    }
+
+  brkbenchStale = 0;
+  proc_t* p = proc_create("brkbench");
+  kthread_t* thr = kthread_create(p, brkbenchRun, niters, (void *)npages);
+  sched_make_runnable(thr);
+  do_waitpid(p->p_pid, 0, NULL);
+
+  if(0 > brkbenchErr)
+    {
+      kprintf(k, "brk failed: %d\n", brkbenchErr);
+      return 0;
+    }
+  kprintf(k, "%u rounds of %u pages\n", niters, npages / 2);
+  kprintf(k, "no reserve:   %u cycles/round\n", brkbenchCycles[0] / niters);
+  kprintf(k, "with reserve: %u cycles/round (%u shrinks kept, %u grows reused)\n",
+          brkbenchCycles[1] / niters, brk_nreserve_kept - kept, brk_nreserve_hits - hits);
+  kprintf(k, "%u pages grown into did not read as zeroes\n", brkbenchStale);
+  return 0;
+}
+
+/* paths resolved by dcachebench: one which exists, one which does not */
+static const char *dcachebenchPath[2] = { "/usr/bin/hello", "/usr/bin/nosuchfile" };
+#define DCACHEBENCH_NCOMPONENTS 3
+#ifdef __GETCWD__
+static char dcachebenchCwd[64];
+#endif
+
+/*
+ * Path lookup microbenchmark: resolves each of dcachebenchPath niters
+ * times with open_namev, with the name cache off and on, and prints the
+ * average cycles per path component. With GETCWD it also times
+ * lookup_dirpath of /usr/bin. Optional argument: iterations.
+ */
+static int dcachebenchTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t niters = 1000;
+  uint32_t cycles[2][2];
+  uint32_t i = 0, start = 0;
+  int pass = 0, path = 0, res = 0;
+  vnode_t *vn = NULL;
+
+  if(1 < argc1)
+    niters = strtol(argv1[1], NULL, 10);
+  if(0 == niters)
+    {
+      kprintf(k, "usage: dcachebench [iterations]\n");
+      return 0;
+    }
+
+  for(pass = 0; pass < 2; pass++)
+    {
+      dcache_enabled = pass;
+      for(path = 0; path < 2; path++)
+        {
+          /* warm up the vnode and page caches */
+          if(0 == open_namev(dcachebenchPath[path], 0, &vn, NULL))
+            vput(vn);
+          start = brkbenchRdtsc();
+          for(i = 0; i < niters; i++)
+            {
+              if(0 == (res = open_namev(dcachebenchPath[path], 0, &vn, NULL)))
+                vput(vn);
+            }
+          cycles[pass][path] = (brkbenchRdtsc() - start) / (niters * DCACHEBENCH_NCOMPONENTS);
+          if((0 == path) && (0 > res))
+            {
+              dcache_enabled = 1;
+              kprintf(k, "%s: lookup failed: %d\n", dcachebenchPath[path], res);
+              return 0;
+            }
+        }
+    }
+  dcache_enabled = 1;
+
+  kprintf(k, "%u lookups of each path, cycles per component:\n", niters);
+  kprintf(k, "%-20s no cache %6u   name cache %6u\n", dcachebenchPath[0], cycles[0][0], cycles[1][0]);
+  kprintf(k, "%-20s no cache %6u   name cache %6u\n", dcachebenchPath[1], cycles[0][1], cycles[1][1]);
+
+#ifdef __GETCWD__
+  /* and back: the path of /usr/bin, per call */
+  if(0 > (res = open_namev("/usr/bin", 0, &vn, NULL)))
+    {
+      kprintf(k, "/usr/bin: lookup failed: %d\n", res);
+      return 0;
+    }
+  for(pass = 0; pass < 2; pass++)
+    {
+      dcache_enabled = pass;
+      lookup_dirpath(vn, dcachebenchCwd, sizeof(dcachebenchCwd));
+      start = brkbenchRdtsc();
+      for(i = 0; i < niters; i++)
+        res = lookup_dirpath(vn, dcachebenchCwd, sizeof(dcachebenchCwd));
+      cycles[pass][0] = (brkbenchRdtsc() - start) / niters;
+    }
+  dcache_enabled = 1;
+  vput(vn);
+  kprintf(k, "getcwd %-13s no cache %6u   name cache %6u (cycles per call)\n",
+          (0 > res) ? "failed" : dcachebenchCwd, cycles[0][0], cycles[1][0]);
+#endif
+  return 0;
+}
+
+/* number of mremaptest checks which failed, set by mremaptestRun */
+static int mremaptestBad;
+
+/*
+ * Body of the mremaptest process. Maps two adjacent 4 page anonymous
+ * areas, a writable and b read-only so that they stay separate areas,
+ * and fills a. Then:
+ *  - a cannot grow without MREMAP_MAYMOVE, b grows in place to 8 pages;
+ *  - a grows to 8 pages by moving, and its contents move along;
+ *  - a shrinks to 2 pages and grows back to 4 in place, and the pages
+ *    given back read as zeroes again;
+ *  - the first page of a 4 page area c is moved and grown to 2 pages,
+ *    and the new page reads as zeroes, not as c's second page.
+ */
+static void *mremaptestRun (int arg1, void *arg2)
+{
+  void *a = NULL, *b = NULL, *c = NULL, *ret = NULL;
+  uint32_t i = 0, val = 0;
+
+  mremaptestBad = 0;
+  if((0 > do_mmap(NULL, 4 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0, &a))
+     || (0 > do_mmap(NULL, 4 * PAGE_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0, &b))
+     || ((char *)b != (char *)a + 4 * PAGE_SIZE))
+    {
+      mremaptestBad = -1;
+      return NULL;
+    }
+  for(i = 0; i < 4; i++)
+    {
+      val = i + 1;
+      vmmap_write(curproc->p_vmmap, (char *)a + i * PAGE_SIZE, &val, sizeof(val));
+    }
+
+  /* b sits right after a, so a cannot grow without moving */
+  if(-ENOMEM != do_mremap(a, 4 * PAGE_SIZE, 8 * PAGE_SIZE, 0, &ret))
+    mremaptestBad++;
+  if((0 > do_mremap(b, 4 * PAGE_SIZE, 8 * PAGE_SIZE, 0, &ret)) || (ret != b))
+    mremaptestBad++;
+  if(0 == do_mremap(a, 4 * PAGE_SIZE, 8 * PAGE_SIZE, MREMAP_MAYMOVE, &ret))
+    {
+      if(ret == a)
+        mremaptestBad++;
+      for(i = 0; i < 4; i++)
+        {
+          vmmap_read(curproc->p_vmmap, (char *)ret + i * PAGE_SIZE, &val, sizeof(val));
+          if(val != i + 1)
+            mremaptestBad++;
+        }
+      if(NULL != vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(a)))
+        mremaptestBad++;
+      a = ret;
+    }
+  else
+    mremaptestBad++;
+
+  /* shrink and regrow: what was unmapped must not come back */
+  if((0 > do_mremap(a, 8 * PAGE_SIZE, 2 * PAGE_SIZE, 0, &ret))
+     || (0 > do_mremap(a, 2 * PAGE_SIZE, 4 * PAGE_SIZE, 0, &ret)) || (ret != a))
+    mremaptestBad++;
+  else
+    {
+      for(i = 2; i < 4; i++)
+        {
+          vmmap_read(curproc->p_vmmap, (char *)a + i * PAGE_SIZE, &val, sizeof(val));
+          if(0 != val)
+            mremaptestBad++;
+        }
+    }
+
+  /* grow part of an area: the rest of it keeps its pages to itself */
+  if(0 > do_mmap(NULL, 4 * PAGE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANON, -1, 0, &c))
+    mremaptestBad++;
+  else
+    {
+      for(i = 0; i < 4; i++)
+        {
+          val = 100 + i;
+          vmmap_write(curproc->p_vmmap, (char *)c + i * PAGE_SIZE, &val, sizeof(val));
+        }
+      if(0 > do_mremap(c, PAGE_SIZE, 2 * PAGE_SIZE, MREMAP_MAYMOVE, &ret))
+        mremaptestBad++;
+      else
+        {
+          vmmap_read(curproc->p_vmmap, (char *)ret + PAGE_SIZE, &val, sizeof(val));
+          if(0 != val)
+            mremaptestBad++;
+          vmmap_read(curproc->p_vmmap, (char *)c + PAGE_SIZE, &val, sizeof(val));
+          if(101 != val)
+            mremaptestBad++;
+        }
+    }
+  return NULL;
+}
+
+/*
+ * mremap test: runs mremaptestRun in a new process and prints how many
+ * of its checks failed.
+ */
+static int mremapTest (kshell_t *k, int argc1, char **argv1)
+{
+  proc_t* p = proc_create("mremaptest");
+  kthread_t* thr = kthread_create(p, mremaptestRun, 0, NULL);
+  sched_make_runnable(thr);
+  do_waitpid(p->p_pid, 0, NULL);
+
+  if(0 > mremaptestBad)
+    kprintf(k, "mmap failed\n");
+  else
+    kprintf(k, "%d checks failed\n", mremaptestBad);
+  return 0;
+}
+
+/* number of zeropagetest checks which failed, set by zeropagetestRun */
+static int zeropagetestBad;
+
+/*
+ * Body of the zeropagetest process: read-faults a page of fresh
+ * anonymous memory, which maps the shared zero page, copies a word into
+ * it with copy_to_user as read(2) would (nothing is resident, so the
+ * copy takes the vmmap_write path), then reads the word back the way
+ * the process would: through its mapping, or after the fault taken
+ * when there is none.
+ */
+static void *zeropagetestRun (int arg1, void *arg2)
+{
+  void *a = NULL;
+  uint32_t val = 0x5a5a0001, word = 0;
+  uintptr_t zerophys = pt_virt_to_phys((uintptr_t)anon_zeropage());
+
+  zeropagetestBad = 0;
+  if(0 > do_mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0, &a))
+    {
+      zeropagetestBad = -1;
+      return NULL;
+    }
+  handle_pagefault((uintptr_t)a, FAULT_USER);
+  if(pt_virt_to_phys((uintptr_t)a) != zerophys)
+    zeropagetestBad++;
+
+  if(0 > copy_to_user(a, &val, sizeof(val)))
+    zeropagetestBad++;
+  if(pt_virt_to_phys((uintptr_t)a) == zerophys)
+    zeropagetestBad++;
+  if(0 == ADDR_TO_PN(pt_virt_to_phys((uintptr_t)a)))
+    handle_pagefault((uintptr_t)a, FAULT_USER);
+  word = *(uint32_t *)a;
+  if(word != val)
+    zeropagetestBad++;
+  return NULL;
+}
+
+static int zeropageTest (kshell_t *k, int argc1, char **argv1)
+{
+  proc_t* p = proc_create("zeropagetest");
+  kthread_t* thr = kthread_create(p, zeropagetestRun, 0, NULL);
+  sched_make_runnable(thr);
+  do_waitpid(p->p_pid, 0, NULL);
+
+  if(0 > zeropagetestBad)
+    kprintf(k, "mmap failed\n");
+  else
+    kprintf(k, "%d checks failed\n", zeropagetestBad);
+  return 0;
+}
+
+/* bytes each ringbench read asks for */
+#define RINGBENCH_NBYTES 512
+
+/* set by ringbenchRun: cycles per read each way, and reads which failed */
+static uint32_t ringbenchCycles[2];
+static int ringbenchBad;
+
+/*
+ * Body of the ringbench process: reads the start of /usr/bin/hello into
+ * a user buffer niters times with do_read plus the copy out sys_read
+ * makes, then the same reads through an I/O ring, IORING_SQ_ENTRIES per
+ * ring_enter.
+ */
+static void *ringbenchRun (int arg1, void *arg2)
+{
+  char kbuf[RINGBENCH_NBYTES];
+  ioring_map_t *ring = NULL;
+  ioring_sqe_t sqe;
+  ioring_cqe_t cqe;
+  void *buf = NULL;
+  uint32_t niters = (uint32_t)arg1, i = 0, j = 0, n = 0, tail = 0, start = 0;
+  int fd = 0, res = 0;
+
+  ringbenchBad = 0;
+  if((0 > (fd = do_open("/usr/bin/hello", O_RDONLY)))
+     || (0 > do_mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0, &buf))
+     || (0 > ioring_setup((void **)&ring)))
+    {
+      ringbenchBad = -1;
+      return NULL;
+    }
+
+  start = brkbenchRdtsc();
+  for(i = 0; i < niters; i++)
+    {
+      do_lseek(fd, 0, SEEK_SET);
+      if((RINGBENCH_NBYTES != (res = do_read(fd, kbuf, RINGBENCH_NBYTES)))
+         || (0 > vmmap_write(curproc->p_vmmap, buf, kbuf, res)))
+        ringbenchBad++;
+    }
+  ringbenchCycles[0] = (brkbenchRdtsc() - start) / niters;
+
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.sqe_op = IORING_OP_READ;
+  sqe.sqe_fd = fd;
+  sqe.sqe_buf = buf;
+  sqe.sqe_len = RINGBENCH_NBYTES;
+  sqe.sqe_off = 0;
+  start = brkbenchRdtsc();
+  for(i = 0; i < niters; i += n)
+    {
+      n = MIN(niters - i, IORING_SQ_ENTRIES);
+      for(j = 0; j < n; j++)
+        {
+          sqe.sqe_data = i + j;
+          vmmap_write(curproc->p_vmmap, &ring->ih_sq[(tail + j) % IORING_SQ_ENTRIES], &sqe, sizeof(sqe));
+        }
+      tail += n;
+      vmmap_write(curproc->p_vmmap, &ring->ih_sq_tail, &tail, sizeof(tail));
+      if((int)n != ioring_enter(n, n))
+        ringbenchBad++;
+      for(j = tail - n; j < tail; j++)
+        {
+          vmmap_read(curproc->p_vmmap, &ring->ih_cq[j % IORING_CQ_ENTRIES], &cqe, sizeof(cqe));
+          if(RINGBENCH_NBYTES != cqe.cqe_res)
+            ringbenchBad++;
+        }
+      vmmap_write(curproc->p_vmmap, &ring->ih_cq_head, &tail, sizeof(tail));
+    }
+  ringbenchCycles[1] = (brkbenchRdtsc() - start) / niters;
+
+  /* a ring whose page is gone is dropped, as after an exec */
+  do_munmap(ring, PAGE_SIZE);
+  if((-EINVAL != ioring_enter(0, 0)) || (0 > ioring_setup((void **)&ring)))
+    ringbenchBad++;
+
+  do_close(fd);
+  return NULL;
+}
+
+/*
+ * I/O ring benchmark: runs ringbenchRun in a new process, whose ring
+ * goes away with it, and prints the cycles per read both ways. Optional
+ * argument: number of reads.
+ */
+static int ringbenchTest (kshell_t *k, int argc1, char **argv1)
+{
+  uint32_t niters = 1024;
+  uint32_t nops = ioring_nops, nbatches = ioring_nbatches;
+  proc_t* p = NULL;
+  kthread_t* thr = NULL;
+
+  if(1 < argc1)
+    niters = strtol(argv1[1], NULL, 10);
+  if(0 == niters)
+    {
+      kprintf(k, "usage: ringbench [reads]\n");
+      return 0;
+    }
+
+  p = proc_create("ringbench");
+  thr = kthread_create(p, ringbenchRun, niters, NULL);
+  sched_make_runnable(thr);
+  do_waitpid(p->p_pid, 0, NULL);
+
+  if(0 > ringbenchBad)
+    {
+      kprintf(k, "setup failed\n");
+      return 0;
+    }
+  kprintf(k, "%u reads of %d bytes, cycles per read (no trap either way):\n",
+          niters, RINGBENCH_NBYTES);
+  kprintf(k, "read:  %6u\n", ringbenchCycles[0]);
+  kprintf(k, "ring:  %6u (%u ops in %u worker batches)\n", ringbenchCycles[1],
+          ioring_nops - nops, ioring_nbatches - nbatches);
+  kprintf(k, "%d reads failed\n", ringbenchBad);
+  return 0;
+}
 
 void* vm_test(long int arg1, void* arg2)
 {
@@ -412,6 +1120,16 @@ void* vm_test(long int arg1, void* arg2)
   kshell_add_command("testls", lsTest, "Launches the ls userland program");
   kshell_add_command("testhalt", haltTest, "Launches the halt userland program to halt system");
   kshell_add_command("testEd", edTest, "Launches the Editor userland program");
+  kshell_add_command("vmstat", vmstatTest, "Prints virtual memory statistics");
+  kshell_add_command("swaptest", swapTest, "Overcommits anonymous memory 3x to exercise swap");
+  kshell_add_command("zramstat", zramstatTest, "Prints compressed page pool statistics");
+  kshell_add_command("vfsstat", vfsstatTest, "Prints vnode cache statistics");
+  kshell_add_command("dcachebench", dcachebenchTest, "Times path lookups with and without the name cache");
+  kshell_add_command("vmmaptest", vmmapTest, "Checks the vmmap area tree against its list");
+  kshell_add_command("brkbench", brkbenchTest, "Times shrinking and regrowing the heap with brk");
+  kshell_add_command("mremaptest", mremapTest, "Grows mappings with mremap, in place and by moving them");
+  kshell_add_command("zeropagetest", zeropageTest, "Writes into a zero-page mapped page from the kernel");
+  kshell_add_command("ringbench", ringbenchTest, "Times file reads through an I/O ring against plain reads");
   
   kernel_execve("/sbin/init", argv, envp);
   return 0;
@@ -16,6 +16,10 @@
 #include "mm/pagetable.h"
 
 #include "vm/vmmap.h"
+#include "vm/anonmem.h"
+#include "vm/madvise.h"
+#include "vm/brkheap.h"
+#include "fs/vcache.h"
 
 /*
  * In this file, physical pages (as represented by pframes) will be
@@ -29,10 +33,9 @@
  *     - (3) pinned
  *
  * (1) Free pages do not contain identifiable data and are readily
- *     available for use. They are not pre-zeroed (at the moment, at least
- *     (but often times, OSs will have their equivalent of Weenix's
- *     idleproc (or another thread/process dedicated to this purpose) zero
- *     unzeroed pages on the free list when the system is otherwise idle)).
+ *     available for use. They are not pre-zeroed, but the idle loop keeps
+ *     a small pool of zeroed page frames (see anon_zeropool_refill) that
+ *     pframe_alloc hands to anonymous objects.
  *
  * (2) Allocated pages contain identifiable data.
  *
@@ -104,6 +107,10 @@ static ktqueue_t pageoutd_waitq;
 /* threads waiting for pageoutd to run sleep on this queue */
 static ktqueue_t alloc_waitq;
 
+/* passes pageoutd has finished, and what the last one freed */
+static uint32_t pageoutd_npasses = 0;
+static int pageoutd_nfreed = 0;
+
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
@@ -218,6 +225,9 @@ pframe_get_resident(struct mmobj *o, uint32_t pagenum)
  * page's object, pagenum, and flags, pin count, and links. We also update the
  * object's nrespages.
  *
+ * Pages of anonymous objects are taken from the pre-zeroed pool when it has
+ * any; such pages are flagged PF_ZEROED so anon_fillpage can skip its memset.
+ *
  * @param o the mmobj identifying this page
  * @param pagenum the page number of this page in the object
  *
@@ -227,11 +237,16 @@ static pframe_t *
 pframe_alloc(mmobj_t *o, uint32_t pagenum)
 {
         pframe_t *pf;
+        void *zeroed = NULL;
         if (NULL == (pf = slab_obj_alloc(pframe_allocator))) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 return NULL;
         }
-        if (NULL == (pf->pf_addr = page_alloc())) {
+        if (mmobj_is_anon(o))
+                zeroed = anon_zeropool_take();
+        if (NULL != zeroed) {
+                pf->pf_addr = zeroed;
+        } else if (NULL == (pf->pf_addr = page_alloc())) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 slab_obj_free(pframe_allocator, pf);
                 return NULL;
@@ -243,6 +258,8 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
         pf->pf_obj = o;
         pf->pf_pagenum = pagenum;
         pf->pf_flags = 0;
+        if (NULL != zeroed)
+                pframe_set_zeroed(pf);
         sched_queue_init(&pf->pf_waitq);
         pf->pf_pincount = 0;
 
@@ -274,6 +291,20 @@ pframe_fill(pframe_t *pf)
         return ret;
 }
 
+/*
+ * Wakes pageoutd and waits for it. Returns 0 if the pass it finished
+ * meanwhile freed no page, 1 otherwise.
+ */
+static int
+pframe_wait_pageout(void)
+{
+        uint32_t npasses = pageoutd_npasses;
+
+        pageoutd_wakeup();
+        sched_sleep_on(&alloc_waitq);
+        return (npasses == pageoutd_npasses) || (0 < pageoutd_nfreed);
+}
+
 /*
  * Find and return the pframe representing the page identified by the object
  * and page number. If the page is already resident in memory, then we return
@@ -289,6 +320,10 @@ pframe_fill(pframe_t *pf)
  *
  * This routine may block at the mmobj operation level.
  *
+ * When memory is short it waits for pageoutd; once a pageoutd pass has
+ * freed nothing (everything left is pinned, busy or cannot be written
+ * out) it fails with -ENOMEM rather than waiting again.
+ *
  * @param o the parent object of the page
  * @param pagenum the page number of this page in the object
  * @param result used to return the pframe (NULL if there's an error)
@@ -299,20 +334,44 @@ pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 {
 
     pframe_t *pframe_temp;
+    int stalled = 0;
+find:
     pframe_temp = pframe_get_resident(o, pagenum);
 
     if (pframe_temp == NULL) {
-            if(pageoutd_needed()) {
-                    pageoutd_wakeup();
+            if(pageoutd_needed() && !stalled) {
+                    /* if pageoutd freed nothing, take what is left */
+                    stalled = !pframe_wait_pageout();
+                    /* the page may have been brought in while we slept */
+                    goto find;
             }
             pframe_temp = pframe_alloc(o,pagenum);
+            if (NULL == pframe_temp) {
+                    if (list_empty(&alloc_list) || stalled
+                        || !pframe_wait_pageout()) {
+                            *result = NULL;
+                            return -ENOMEM;
+                    }
+                    goto find;
+            }
             int retval = pframe_fill(pframe_temp);
+            if (0 > retval) {
+                    /* do not leave a page with no contents behind */
+                    while (pframe_is_pinned(pframe_temp))
+                            pframe_unpin(pframe_temp);
+                    pframe_free(pframe_temp);
+                    *result = NULL;
+                    return retval;
+            }
             *result = pframe_temp;
             return retval;
     }
 
-    while(pframe_is_busy(pframe_temp)){
-            pframe_temp = pframe_get_resident(o,pagenum);
+    if (pframe_is_busy(pframe_temp)) {
+            /* being filled, cleaned or freed (fills and cleans of
+             * anonymous pages block on swap I/O); wait and look again */
+            sched_sleep_on(&pframe_temp->pf_waitq);
+            goto find;
     }
 
     *result = pframe_temp;
@@ -448,6 +507,32 @@ pframe_unpin(pframe_t *pf)
             } list_iterate_end();*/
 }
 
+/*
+ * Moves an unpinned page to the head of alloc_list, so that pageoutd
+ * reclaims it before pages which were used less recently. For pages
+ * which are unlikely to be used again, e.g. behind a sequential scan.
+ *
+ * @param pf the page
+ */
+void
+pframe_deactivate(pframe_t *pf)
+{
+        if (pframe_is_pinned(pf) || pframe_is_busy(pf))
+                return;
+        list_remove(&pf->pf_link);
+        list_insert_head(&alloc_list, &pf->pf_link);
+}
+
+/*
+ * Returns 1 while free memory is below the level pageoutd reclaims up
+ * to, for caches which should stop holding on to pages.
+ */
+int
+pframe_memory_low(void)
+{
+        return !pageoutd_target_met();
+}
+
 /*  Mahesh
 void
 pframe_unpin(pframe_t *pf)
@@ -694,6 +779,9 @@ pageoutd_exit()
  * page is busy before yanking it. If the page you select is dirty, make sure
  * to clean it before yanking it. Finally, go back to sleep after having paged
  * out the appropriate page.
+ *
+ * With swap enabled, anonymous and shadow pages are no longer pinned, so
+ * they show up on the allocated list too; cleaning them writes them to swap.
  * Both arguments unused.
  */
 static void *
@@ -701,6 +789,20 @@ pageoutd_run(int arg1, void *arg2)
 {
         while (1) {
                 KASSERT(nallocated >= 0);
+                int nfailed = 0;
+                int nfreed = 0;
+
+                /* pre-zeroed frames are the cheapest memory to give back */
+                if (!pageoutd_target_met()) {
+                        nfreed += anon_zeropool_count();
+                        anon_zeropool_drain();
+                }
+                /* and inactive vnodes hold on to their inode's page */
+                if (!pageoutd_target_met())
+                        nfreed += vnode_inactive_trim(NULL, VNODE_INACTIVE_MAX / 4);
+                /* so do brk reserves, which nobody may read */
+                if (!pageoutd_target_met())
+                        nfreed += brk_reserve_reclaim();
                 while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
                         pframe_t *pf;
 
@@ -710,15 +812,26 @@ pageoutd_run(int arg1, void *arg2)
                         if (pframe_is_busy(pf)) {
                                 sched_sleep_on(&pf->pf_waitq);
                         } else if (pframe_is_dirty(pf)) {
-                                pframe_clean(pf);
+                                if (0 > pframe_clean(pf)) {
+                                        /* e.g. swap is full; move on to the
+                                         * next page rather than retrying
+                                         * this one forever */
+                                        list_remove(&pf->pf_link);
+                                        list_insert_tail(&alloc_list, &pf->pf_link);
+                                        if (++nfailed >= nallocated)
+                                                break;
+                                }
                         } else {
                                 /* it's not busy, it's clean, and it's
                                  * least-recently-requested; reclaim it: */
                                 pframe_free(pf);
+                                nfreed++;
                         }
                 }
 
                 /*   release the thundering herd... */
+                pageoutd_nfreed = nfreed;
+                pageoutd_npasses++;
                 sched_broadcast_on(&alloc_waitq);
 
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Falling asleep\n");
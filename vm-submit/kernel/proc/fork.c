@@ -18,9 +18,12 @@
 
 #include "fs/file.h"
 #include "fs/vnode.h"
+#include "fs/fdtable.h"
 
 #include "vm/shadow.h"
 #include "vm/vmmap.h"
+#include "vm/vmmapext.h"
+#include "vm/tlbflush.h"
 
 #include "api/exec.h"
 
@@ -79,6 +82,8 @@ do_fork(struct regs *regs)
   mmobj_t* sh_p = NULL; /*referes to shadow of parent*/
   mmobj_t* sh_c = NULL; /*referes to shadow of child*/
   int fCounter=0;
+  tlb_batch_t tb;
+  tlb_batch_init(&tb, TLB_FORK);
   newproc->p_vmmap = vmmap_clone(curproc->p_vmmap);
 
   
@@ -108,7 +113,8 @@ do_fork(struct regs *regs)
                   
                     vmareaP->vma_obj = sh_p;
                     
-                    pt_unmap_range(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(vmareaP->vma_start), (uintptr_t)PN_TO_ADDR(vmareaP->vma_end));                                 
+                    /* only the pages the parent actually mapped need to fault again */
+                    vmarea_unmap(vmareaP, vmareaP->vma_start, vmareaP->vma_end, &tb);
                                             
 	}
       else
@@ -125,7 +131,7 @@ do_fork(struct regs *regs)
   
     kthread_t* threadIterator = NULL;
     kthread_t* newthr = NULL;
-    tlb_flush_all();
+    tlb_batch_finish(&tb);
 
   
   
@@ -152,12 +158,11 @@ do_fork(struct regs *regs)
     }list_iterate_end();
 		
   
-    fCounter=0;
-  for(;fCounter<NFILES;fCounter++)
+  /* copy the open descriptors only, found through the bitmap */
+  for(fCounter=fd_next(curproc, 0);0<=fCounter;fCounter=fd_next(curproc, fCounter+1))
     {
-	  newproc->p_files[fCounter]=curproc->p_files[fCounter];
-      if(NULL != curproc->p_files[fCounter])
-	fref(curproc->p_files[fCounter]);
+      fref(curproc->p_files[fCounter]);
+      fd_install(newproc, fCounter, curproc->p_files[fCounter]);
     }
 
   
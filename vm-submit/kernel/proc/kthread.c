@@ -1,3 +1,4 @@
+#include "kernel.h"
 #include "config.h"
 #include "globals.h"
 
@@ -11,6 +12,7 @@
 #include "proc/kthread.h"
 #include "proc/proc.h"
 #include "proc/sched.h"
+#include "proc/kthreadbuf.h"
 
 #include "mm/slab.h"
 #include "mm/page.h"
@@ -18,6 +20,12 @@
 kthread_t *curthr; /* global */
 static slab_allocator_t *kthread_allocator = NULL;
 
+/* threads are allocated together with their bounce page pointer */
+typedef struct kthread_ext {
+	kthread_t	 ke_thr;
+	void		*ke_bounce;
+} kthread_ext_t;
+
 #ifdef __MTP__
 /* Stuff for the reaper daemon, which cleans up dead detached threads */
 static proc_t *reapd = NULL;
@@ -31,7 +39,7 @@ static void *kthread_reapd_run(int arg1, void *arg2);
 void
 kthread_init()
 {
-	kthread_allocator = slab_allocator_create("kthread", sizeof(kthread_t));
+	kthread_allocator = slab_allocator_create("kthread", sizeof(kthread_ext_t));
 	KASSERT(NULL != kthread_allocator);
 }
 
@@ -83,7 +91,9 @@ kthread_create(struct proc *p, kthread_func_t func, long arg1, void *arg2)
 	
 	
 
-	kthread_t *thr =(kthread_t*) slab_obj_alloc(kthread_allocator);
+	kthread_ext_t *tExt = (kthread_ext_t *)slab_obj_alloc(kthread_allocator);
+	kthread_t *thr = &tExt->ke_thr;
+	tExt->ke_bounce = NULL;
 	
 	thr->kt_kstack = alloc_stack();
 	thr->kt_retval = NULL;
@@ -116,7 +126,23 @@ kthread_destroy(kthread_t *t)
 	if (list_link_is_linked(&(t->kt_plink)))
 		list_remove(&t->kt_plink);
 
-	slab_obj_free(kthread_allocator, t);
+	if (NULL != CONTAINER_OF(t, kthread_ext_t, ke_thr)->ke_bounce)
+		page_free(CONTAINER_OF(t, kthread_ext_t, ke_thr)->ke_bounce);
+	slab_obj_free(kthread_allocator, CONTAINER_OF(t, kthread_ext_t, ke_thr));
+}
+
+/*
+ * Returns the bounce page of thr, allocating it if need be, or NULL if
+ * there is no memory for it.
+ */
+void *
+kthread_bounce_page(kthread_t *thr)
+{
+	kthread_ext_t *tExt = CONTAINER_OF(thr, kthread_ext_t, ke_thr);
+
+	if (NULL == tExt->ke_bounce)
+		tExt->ke_bounce = page_alloc();
+	return tExt->ke_bounce;
 }
 
 /*
@@ -185,7 +211,9 @@ kthread_exit(void *retval)
 kthread_t *
 kthread_clone(kthread_t *thr)
 {
-	kthread_t* cthread = slab_obj_alloc(kthread_allocator);
+	kthread_ext_t *cExt = (kthread_ext_t *)slab_obj_alloc(kthread_allocator);
+	kthread_t* cthread = &cExt->ke_thr;
+	cExt->ke_bounce = NULL;
 
 	memcpy(&cthread->kt_ctx, &thr->kt_ctx, sizeof(context_t));
 	cthread->kt_kstack= alloc_stack();
@@ -12,6 +12,7 @@
 #include "proc/proc.h"
 #include "proc/sched.h"
 #include "proc/proc.h"
+#include "proc/procstat.h"
 
 #include "mm/slab.h"
 #include "mm/page.h"
@@ -25,10 +26,20 @@
 #include "fs/vfs_syscall.h"
 #include "fs/vnode.h"
 #include "fs/file.h"
+#include "fs/fdtable.h"
+
+#include "api/ioring.h"
 
 proc_t *curproc = NULL; /* global */
 static slab_allocator_t *proc_allocator = NULL;
 
+/* processes are allocated together with their statistics and fd bitmap */
+typedef struct proc_ext {
+  proc_t      pe_proc;
+  proc_stat_t pe_stat;
+  uint32_t    pe_fdmap[FD_NWORDS];
+} proc_ext_t;
+
 static list_t _proc_list;
 static proc_t *proc_initproc = NULL; /* Pointer to the init process (PID 1) */
 
@@ -36,10 +47,24 @@ void
 proc_init()
 {
   list_init(&_proc_list);
-  proc_allocator = slab_allocator_create("proc", sizeof(proc_t));
+  proc_allocator = slab_allocator_create("proc", sizeof(proc_ext_t));
   KASSERT(proc_allocator != NULL);
 }
 
+proc_stat_t proc_stats_exited;
+
+proc_stat_t *
+proc_stats(proc_t *p)
+{
+  return &CONTAINER_OF(p, proc_ext_t, pe_proc)->pe_stat;
+}
+
+uint32_t *
+proc_fdmap(proc_t *p)
+{
+  return CONTAINER_OF(p, proc_ext_t, pe_proc)->pe_fdmap;
+}
+
 static pid_t next_pid = 0;
 
 /**
@@ -85,8 +110,11 @@ _proc_getid()
 proc_t *
 proc_create(char *name)
 {
-  proc_t *pObj = (proc_t *)slab_obj_alloc(proc_allocator);
-  KASSERT(pObj != NULL && "proc_create : Process created is NULL");
+  proc_ext_t *pExt = (proc_ext_t *)slab_obj_alloc(proc_allocator);
+  KASSERT(pExt != NULL && "proc_create : Process created is NULL");
+  proc_t *pObj = &pExt->pe_proc;
+  memset(&pExt->pe_stat, 0, sizeof(pExt->pe_stat));
+  memset(pExt->pe_fdmap, 0, sizeof(pExt->pe_fdmap));
 
   pObj->p_pid = _proc_getid();
   
@@ -227,12 +255,13 @@ proc_cleanup(int status)
   KASSERT(curproc->p_pproc);
 
   int counter= 0;
+
+  /* the ring worker uses our files and address space */
+  ioring_destroy(curproc);
   
-  for(counter=0;counter<NFILES;counter++)
-    {
-      if(curproc->p_files[counter])
-        fput(curproc->p_files[counter]);
-    }
+  /* only the open descriptors, as the bitmap has them */
+  for(counter=fd_next(curproc, 0);0<=counter;counter=fd_next(curproc, counter+1))
+    fput(fd_clear(curproc, counter));
   if(proc_initproc)
     vput(curproc->p_cwd);
 
@@ -364,12 +393,15 @@ void disposeZombie(proc_t* pZombie) {
         list_remove(&(pZombie->p_list_link));
 
 
+        proc_stats_exited.ps_nfaults += proc_stats(pZombie)->ps_nfaults;
+        proc_stats_exited.ps_nfaultaround += proc_stats(pZombie)->ps_nfaultaround;
+
         pZombie->p_start_brk = NULL;
         pZombie->p_cwd = NULL;
         pZombie->p_brk = NULL;
         pZombie->p_vmmap = NULL;
 
-        slab_obj_free(proc_allocator, pZombie);
+        slab_obj_free(proc_allocator, CONTAINER_OF(pZombie, proc_ext_t, pe_proc));
 
 }
 
@@ -538,11 +570,14 @@ proc_info(const void *arg, char *buf, size_t osize)
     iprintf(&buf, &size, "cwd:          -\n");
   }
 #endif /* __GETCWD__ */
+  iprintf(&buf, &size, "open files:   %d\n", fd_count((proc_t *)p));
 #endif
 
 #ifdef __VM__
   iprintf(&buf, &size, "start brk:    0x%p\n", p->p_start_brk);
   iprintf(&buf, &size, "brk:          0x%p\n", p->p_brk);
+  iprintf(&buf, &size, "page faults:  %u (+%u pages mapped around)\n",
+          proc_stats((proc_t *)p)->ps_nfaults, proc_stats((proc_t *)p)->ps_nfaultaround);
 #endif
 
   return size;
@@ -9,6 +9,8 @@
 #include "util/init.h"
 #include "util/debug.h"
 
+#include "vm/anonmem.h"
+
 static ktqueue_t kt_runq;
 
 static __attribute__((unused)) void
@@ -203,6 +205,10 @@ sched_cancel(struct kthread *kthr)
  * The proper way to do this is with the intr_wait call. See
  * interrupt.h for more details on intr_wait.
  *
+ * Before waiting, the otherwise idle CPU zeroes page frames for the
+ * anonymous pre-zeroed pool, one page per pass so that a thread made
+ * runnable by an interrupt is picked up promptly.
+ *
  * Note: When waiting for an interrupt, don't forget to modify the
  * IPL. If the IPL of the currently executing thread masks the
  * interrupt you are waiting for, the interrupt will never happen, and
@@ -222,6 +228,10 @@ sched_switch(void)
 	apic_setipl(IPL_HIGH);
 
 	while(sched_queue_empty(&kt_runq) == 1){
+#ifdef __VM__
+		if(anon_zeropool_refill())
+			continue;
+#endif
 		intr_disable();
 	        apic_setipl(IPL_LOW);
 		dbg(DBG_PRINT, "interupt waiting..\n");
@@ -11,10 +11,33 @@
 #include "mm/slab.h"
 #include "mm/tlb.h"
 
+#include "vm/anonmem.h"
+#include "vm/swap.h"
+
 int anon_count = 0; /* for debugging/verification purposes */
 
 static slab_allocator_t *anon_allocator;
 
+/*
+ * Pool of page frames that have already been zeroed. It is filled by
+ * the idle loop in sched_switch() and drained by pframe_alloc() for
+ * anonymous objects, so that first-touch faults on the heap, the stack
+ * and MAP_ANON regions do not have to memset a page.
+ */
+static void *anon_zeropool[ANON_ZEROPOOL_SIZE];
+static int anon_zeropool_nr = 0;
+
+uint32_t anon_zeropool_hits = 0;
+uint32_t anon_zeropool_misses = 0;
+
+/*
+ * A single page of zeroes which is mapped read-only for read faults on
+ * anonymous memory that has never been written. A private frame is only
+ * allocated when the page is first written.
+ */
+static void *anon_zero_page = NULL;
+uint32_t anon_zeropage_faults = 0;
+
 static void anon_ref(mmobj_t *o);
 static void anon_put(mmobj_t *o);
 static int  anon_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf);
@@ -33,8 +56,8 @@ static mmobj_ops_t anon_mmobj_ops = {
 
 /*
  * This function is called at boot time to initialize the
- * anonymous page sub system. Currently it only initializes the
- * anon_allocator object.
+ * anonymous page sub system. It initializes the anon_allocator
+ * object and the shared zero page.
  */
 void
 anon_init()
@@ -42,6 +65,10 @@ anon_init()
   anon_allocator = slab_allocator_create("anon obj", sizeof(mmobj_t));
   KASSERT(anon_allocator);
   dbg(DBG_ALL, "GRADING3 2.a: anon_allocator is not NULL \n");
+
+  anon_zero_page = page_alloc();
+  KASSERT(anon_zero_page && "could not allocate the shared zero page");
+  memset(anon_zero_page, 0, PAGE_SIZE);
 }
 
 /*
@@ -65,6 +92,81 @@ anon_create()
   return mmobj_temp;
 }
 
+/*
+ * Returns 1 if the given object is an anonymous object, 0 otherwise.
+ */
+int
+mmobj_is_anon(mmobj_t *o)
+{
+  return (&anon_mmobj_ops == o->mmo_ops);
+}
+
+/*
+ * Hands out a pre-zeroed page frame, or NULL if the pool is empty (in
+ * which case the caller should page_alloc() and zero the page itself).
+ */
+void *
+anon_zeropool_take(void)
+{
+  if(0 == anon_zeropool_nr)
+    {
+      anon_zeropool_misses++;
+      return NULL;
+    }
+
+  anon_zeropool_hits++;
+  return anon_zeropool[--anon_zeropool_nr];
+}
+
+/*
+ * Zeroes one more page frame for the pool. Called from the idle loop
+ * with interrupts masked, so it only does a single page of work per
+ * call. Returns 1 if a page was added, 0 if the pool is full or memory
+ * is too tight to set any aside.
+ */
+int
+anon_zeropool_refill(void)
+{
+  void* page = NULL;
+
+  if(ANON_ZEROPOOL_SIZE <= anon_zeropool_nr)
+    return 0;
+  if(ANON_ZEROPOOL_MINFREE >= page_free_count())
+    return 0;
+  if(NULL == (page = page_alloc()))
+    return 0;
+
+  memset(page, 0, PAGE_SIZE);
+  anon_zeropool[anon_zeropool_nr++] = page;
+  return 1;
+}
+
+/*
+ * Gives every pooled page frame back to the page allocator. pageoutd
+ * calls this before it starts evicting pages.
+ */
+void
+anon_zeropool_drain(void)
+{
+  while(0 < anon_zeropool_nr)
+    page_free(anon_zeropool[--anon_zeropool_nr]);
+}
+
+int
+anon_zeropool_count(void)
+{
+  return anon_zeropool_nr;
+}
+
+/*
+ * Returns the kernel address of the shared, read-only zero page.
+ */
+void *
+anon_zeropage(void)
+{
+  return anon_zero_page;
+}
+
 /* Implementation of mmobj entry points: */
 
 /*
@@ -129,7 +231,10 @@ anon_put(mmobj_t *o)
         }
 
       if(0 == temp_c)
-        slab_obj_free( anon_allocator, o);      
+        {
+          swap_drop_obj(o);
+          slab_obj_free( anon_allocator, o);      
+        }
     }
 }
 
@@ -153,23 +258,43 @@ anon_fillpage(mmobj_t *o, pframe_t *pf)
   KASSERT(!pframe_is_pinned(pf));
   dbg(DBG_ALL, "GRADING3 2.d: pframe is pinned \n");
                 
-  pframe_pin(pf);
-  memset(pf->pf_addr, 0, PAGE_SIZE);
+  /* without swap there is no other copy of the data, keep it resident */
+  if(!swap_enabled())
+    pframe_pin(pf);
+
+  int retVal = swap_in(pf);
+  if(0 != retVal)
+    {
+      pframe_clear_zeroed(pf);
+      return (0 > retVal) ? retVal : 0;
+    }
+
+  /* frames from the pre-zeroed pool are already filled */
+  if(pframe_is_zeroed(pf))
+    pframe_clear_zeroed(pf);
+  else
+    memset(pf->pf_addr, 0, PAGE_SIZE);
   
   return 0;
 }
 
+/*
+ * Anonymous pages can only be dirtied (and so later cleaned and
+ * reclaimed by pageoutd) when there is swap space to clean them to.
+ */
 static int
 anon_dirtypage(mmobj_t *o, pframe_t *pf)
 {
- 
+  if(swap_enabled())
+    return 0;
   return -1;
 }
 
+/* Cleaning an anonymous page writes it out to swap. */
 static int
 anon_cleanpage(mmobj_t *o, pframe_t *pf)
 {
- 
-  
+  if(swap_enabled())
+    return swap_out(pf);
   return -1;
 }
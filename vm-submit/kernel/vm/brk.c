@@ -1,3 +1,4 @@
+#include "kernel.h"
 #include "globals.h"
 #include "errno.h"
 #include "util/debug.h"
@@ -5,9 +6,15 @@
 #include "mm/mm.h"
 #include "mm/page.h"
 #include "mm/mman.h"
+#include "mm/pframe.h"
 
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/vmmapext.h"
+#include "vm/tlbflush.h"
+#include "vm/madvise.h"
+#include "vm/brkheap.h"
+#include "vm/swap.h"
 
 #include "proc/proc.h"
 
@@ -52,11 +59,143 @@
  *
  * Note that this function "returns" the new break through the "ret" argument.
  * Return 0 on success, -errno on failure.
+ *
+ * The heap is the vmmap's heap area (vmmap_heap): a private anonymous
+ * area starting at the first page boundary at or above p_start_brk,
+ * or the data area itself if the initial break is not page aligned.
+ * Shrinking the heap leaves up to brk_reserve_max pages past the break
+ * in the area (see vm/brkheap.h): they are unmapped but stay resident,
+ * and growing into them clears them in place instead of allocating new
+ * pages. The fault handler treats accesses to them as accesses past the
+ * break.
+ */
+uint32_t brk_reserve_max = BRK_RESERVE_MAX;
+
+uint32_t brk_ncalls = 0;
+uint32_t brk_nreserve_hits = 0;
+uint32_t brk_nreserve_kept = 0;
+uint32_t brk_npages_released = 0;
+uint32_t brk_npages_reclaimed = 0;
+
+/* first page above a heap whose break is addr */
+#define brk_endpage(addr)  ADDR_TO_PN((uint32_t)(addr) + PAGE_SIZE - 1)
+
+/*
+ * Returns the heap area of the current process. Before the first brk
+ * call with an unaligned initial break this is the data area holding
+ * it, which is then remembered as the heap.
  */
+static vmarea_t *
+brk_heap(void)
+{
+	vmarea_t* heap = vmmap_heap(curproc->p_vmmap);
+
+	if((NULL == heap) && !PAGE_ALIGNED(curproc->p_start_brk))
+	{
+		heap = vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(curproc->p_start_brk));
+		KASSERT(NULL != heap && "the initial break falls into the data area");
+		vmmap_set_heap(curproc->p_vmmap, heap);
+	}
+	return heap;
+}
+
+/*
+ * Cuts the heap area down to end at page newend. The pages cut off are
+ * freed right away, so that the memory goes back to the page allocator
+ * and a later grow sees zeroes again.
+ */
+static void
+brk_trim(vmarea_t *heap, uint32_t newend)
+{
+	uint32_t npages = heap->vma_end - newend;
+
+	madvise_dontneed(heap, newend, heap->vma_end, TLB_BRK);
+	vmmap_remove_cause(curproc->p_vmmap, newend, npages, TLB_BRK);
+	brk_npages_released += npages;
+}
+
+/*
+ * Gives back the reserve of the current process. Called on page faults
+ * while memory is low.
+ */
+void
+brk_release_reserve(void)
+{
+	vmarea_t* heap = vmmap_heap(curproc->p_vmmap);
+	uint32_t hipage = brk_endpage(curproc->p_brk);
+
+	if((NULL != heap) && (hipage < heap->vma_end))
+		brk_trim(heap, MAX(hipage, heap->vma_start));
+}
+
+/*
+ * Frees the resident pages of every process's reserve, for pageoutd
+ * while memory is low: nobody may read them, so they need not be paged
+ * out. The heap areas keep their size; a grow into them sees zeroes all
+ * the same (see do_brk). Returns the number of pages freed.
+ */
+int
+brk_reserve_reclaim(void)
+{
+	proc_t* p = NULL;
+	vmarea_t* heap = NULL;
+	pframe_t* tempFrame = NULL;
+	uint32_t lopage, pagenum, npages;
+	int nfreed = 0;
+
+again:
+	list_iterate_begin(proc_list(), p, proc_t, p_list_link)
+	{
+		if((PROC_DEAD == p->p_state) || (NULL == p->p_vmmap))
+			continue;
+		if(NULL == (heap = vmmap_heap(p->p_vmmap)))
+			continue;
+		lopage = MAX(brk_endpage(p->p_brk), heap->vma_start);
+		if(lopage >= heap->vma_end)
+			continue;
+		pagenum = heap->vma_off + lopage - heap->vma_start;
+		npages = heap->vma_end - lopage;
+
+		list_iterate_begin(&heap->vma_obj->mmo_respages, tempFrame, pframe_t, pf_olink)
+		{
+			if((tempFrame->pf_pagenum - pagenum >= npages)
+			   || pframe_is_busy(tempFrame) || pframe_is_pinned(tempFrame))
+				continue;
+			pframe_clear_dirty(tempFrame);
+			pframe_free(tempFrame);
+			brk_npages_reclaimed++;
+			nfreed++;
+			/* pframe_free may have slept, and the heap changed */
+			goto again;
+		}list_iterate_end();
+		swap_drop_range(heap->vma_obj, pagenum, npages);
+	}list_iterate_end();
+	return nfreed;
+}
+
+/* Returns 1 if page vfn of vma is part of the heap's reserve. */
+int
+brk_in_reserve(vmarea_t *vma, uint32_t vfn)
+{
+	return (vma == vmmap_heap(curproc->p_vmmap)) && (vfn >= brk_endpage(curproc->p_brk));
+}
+
 int
 do_brk(void *addr, void **ret)
 {
-	
+	vmmap_t* map = curproc->p_vmmap;
+	vmarea_t* heap = NULL;
+	uint32_t lopage = 0;
+	uint32_t hipage = 0;
+	uint32_t oldhipage = 0;
+	uint32_t oldend = 0;
+	uint32_t newend = 0;
+	uint32_t keep = 0;
+	void *oldbrk = curproc->p_brk;
+	int growable = 1;
+	int retVal = 0;
+	tlb_batch_t tb;
+
 	if(NULL == addr)
 	{
 		*ret=curproc->p_brk;
@@ -71,63 +210,75 @@ do_brk(void *addr, void **ret)
 		return -ENOMEM;
 	}
 
-	uint32_t finalbrkPg = ADDR_TO_PN(addr);
-	int retVal = 0;
-	vmarea_t* vmarea_temp = NULL;
-	uint32_t uintInitPg = 0;
-	uint32_t initialbrkPg = ADDR_TO_PN(curproc->p_start_brk);
+	brk_ncalls++;
+	lopage = brk_endpage(curproc->p_start_brk);
+	hipage = brk_endpage(addr);
+	oldhipage = brk_endpage(curproc->p_brk);
+	heap = brk_heap();
 
-	
-
-	if(0 == (vmmap_lookup(curproc->p_vmmap,initialbrkPg)))
+	if(NULL == heap)
 	{
-		/*vmarea_t *vmarea_temp;*/
-		retVal = 0;
-		retVal = do_mmap(PN_TO_ADDR(initialbrkPg),(size_t)PN_TO_ADDR(finalbrkPg-initialbrkPg),PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANON ,-1,0,(void**)&vmarea_temp);
-		if(0 > retVal)
+		/* first growth past an aligned initial break */
+		if(hipage > lopage)
 		{
-			return retVal;
+			if(!vmmap_is_range_empty(map, lopage, hipage - lopage))
+				return -ENOMEM;
+			retVal = vmmap_map(map, NULL, lopage, hipage - lopage, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANON, 0, VMMAP_DIR_LOHI, &heap);
+			if(0 > retVal)
+				return retVal;
+			vmmap_set_heap(map, heap);
 		}
-		else
-		    {
-dbg_print("Going to end\n");
-		goto lblEnd;
-		    }
 	}
-
-	uintInitPg = ADDR_TO_PN(curproc->p_brk);
-
-	if(uintInitPg == finalbrkPg )
-		{
-	        goto lblEnd;
-		}
-
-	if(uintInitPg < finalbrkPg )
+	else if(hipage > heap->vma_end)
 	{
-
-	        vmarea_temp = NULL;
-	        vmarea_temp = vmmap_lookup(curproc->p_vmmap, uintInitPg);
-		if(1 != vmmap_is_range_empty(curproc->p_vmmap,vmarea_temp->vma_end, (1 +  finalbrkPg-vmarea_temp->vma_end)))
+		if(!vmmap_is_range_empty(map, heap->vma_end, hipage - heap->vma_end))
+			return -ENOMEM;
+		oldend = heap->vma_end;
+		/* after a fork the objects below the heap's own may still
+		 * hold what was cut off by an earlier shrink */
+		growable = vmmap_area_growable(heap, hipage - oldend);
+		heap->vma_end = hipage;
+		vmmap_area_resized(map, heap);
+		curproc->p_brk = addr;
+		if(oldhipage < oldend)
+			retVal = madvise_zero(heap, MAX(oldhipage, heap->vma_start), oldend);
+		if((0 == retVal) && !growable)
+			retVal = madvise_zero(heap, oldend, hipage);
+	}
+	else if(hipage > oldhipage)
+	{
+		/* the pages are still there from an earlier shrink, but must
+		 * read as zeroes; the break moves first so that pageoutd does
+		 * not take them for reserve while we sleep */
+		curproc->p_brk = addr;
+		retVal = madvise_zero(heap, MAX(oldhipage, heap->vma_start), hipage);
+		brk_nreserve_hits++;
+	}
+	else if(hipage < oldhipage)
+	{
+		keep = pframe_memory_low() ? 0 : brk_reserve_max;
+		newend = MAX(MIN(hipage + keep, heap->vma_end), heap->vma_start);
+		/* keep the pages up to newend, but fault on access past the break */
+		if(hipage < MIN(newend, oldhipage))
 		{
-		        return -ENOMEM;
+			tlb_batch_init(&tb, TLB_BRK);
+			vmarea_unmap(heap, hipage, MIN(newend, oldhipage), &tb);
+			tlb_batch_finish(&tb);
 		}
-		else{
-		        vmarea_temp->vma_end = 1 +  finalbrkPg;
-		                              goto lblEnd;
-		}
-			
+		if(newend < heap->vma_end)
+			brk_trim(heap, newend);
+		else
+			brk_nreserve_kept++;
 	}
-	else
+	if(0 > retVal)
 	{
-		vmmap_remove(curproc->p_vmmap,finalbrkPg+1,uintInitPg-finalbrkPg);
-		goto lblEnd;
+		/* the pages stay part of the heap; they are reserve again */
+		curproc->p_brk = oldbrk;
+		return retVal;
 	}
 
-	lblEnd:
 	curproc->p_brk=addr;
 	*ret = addr;
 	return 0;
-
 }
-
-
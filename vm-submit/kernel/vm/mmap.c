@@ -1,3 +1,4 @@
+#include "kernel.h"
 #include "globals.h"
 #include "errno.h"
 #include "types.h"
@@ -19,12 +20,23 @@
 
 
 #include "vm/vmmap.h"
+#include "vm/vmmapext.h"
+#include "vm/anonmem.h"
+#include "vm/madvise.h"
+#include "vm/readahead.h"
+#include "vm/swap.h"
+#include "vm/tlbflush.h"
+#include "vm/mremap.h"
+#include "vm/brkheap.h"
 #include "vm/mmap.h"
 
 /*
  * This function implements the mmap(2) syscall, but only
- * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, and
- * MAP_ANON flags.
+ * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, MAP_ANON and
+ * MAP_POPULATE flags. With MAP_POPULATE every page of the new
+ * mapping is faulted in and mapped before returning, as far as memory
+ * allows: as in Linux this is best effort, pages it could not bring in
+ * are faulted in on first access and the mapping still succeeds.
  *
  * Add a mapping to the current process's address space.
  * You need to do some error checking; see the ERRORS section
@@ -48,7 +60,7 @@ do_mmap(void *addr, size_t len, int prot, int flags,
 	if(!(PAGE_ALIGNED(off)))
 		return -EINVAL;
 
-	if(flags & ~(MAP_ANON|MAP_FIXED|MAP_PRIVATE|MAP_SHARED))
+	if(flags & ~(MAP_ANON|MAP_FIXED|MAP_PRIVATE|MAP_SHARED|MAP_POPULATE))
 		return -ENOTSUP;
 
 
@@ -121,15 +133,31 @@ do_mmap(void *addr, size_t len, int prot, int flags,
 		tempNode = NULL;
 
 
-	result = vmmap_map( curproc->p_vmmap, tempNode, ADDR_TO_PN(addr),
-			ADDR_TO_PN(len),prot,flags, off, VMMAP_DIR_LOHI, &vmArea);
+	/* private anonymous memory right next to a compatible area just
+	 * grows that area, so that many small mappings do not each get
+	 * an area and a pair of objects of their own */
+	vmArea = NULL;
+	if((NULL == tempNode) && mapPrivate
+	   && vmmap_is_range_empty(curproc->p_vmmap, ADDR_TO_PN(addr), ADDR_TO_PN(len)))
+		vmArea = vmmap_extend_anon(curproc->p_vmmap, ADDR_TO_PN(addr),
+				ADDR_TO_PN(len), prot, flags);
 
-	*ret = PN_TO_ADDR(vmArea->vma_start);
+	if(NULL != vmArea)
+		result = 0;
+	else
+		result = vmmap_map( curproc->p_vmmap, tempNode, ADDR_TO_PN(addr),
+				ADDR_TO_PN(len),prot,flags, off, VMMAP_DIR_LOHI, &vmArea);
+
+	*ret = addr;
 
 	if(!(MAP_ANON & flags))
 		fput(tempFile);
 
-	tlb_flush_range((uintptr_t)addr,len);
+	/* nothing to flush: a new range was never mapped, and whatever
+	 * MAP_FIXED replaced was invalidated by vmmap_map */
+
+	if((0 == result) && (MAP_POPULATE & flags))
+		pagefault_populate(vmArea, ADDR_TO_PN(addr), ADDR_TO_PN(len));
 
 
 	KASSERT(NULL != curproc->p_pagedir);
@@ -147,7 +175,7 @@ do_mmap(void *addr, size_t len, int prot, int flags,
  *
  * As with do_mmap() it should perform the required error checking,
  * before calling upon vmmap_remove() to do most of the work.
- * Remember to clear the TLB.
+ * vmmap_remove() invalidates the TLB entries of whatever it unmapped.
  */
 int
 do_munmap(void *addr, size_t len)
@@ -168,10 +196,252 @@ do_munmap(void *addr, size_t len)
 
 
 	vmmap_remove(curproc->p_vmmap, ADDR_TO_PN(addr), ADDR_TO_PN(len));
-	tlb_flush_all();
 
 	KASSERT(NULL != curproc->p_pagedir);
 	dbg(DBG_ALL, "GRADING3 6.b: page directory of the current process\n");
 	return 0;
 }
 
+/*
+ * MADV_DONTNEED on [lopage, hipage) of vma: the pages are unmapped and
+ * the area's private copies of them are freed, so that the next access
+ * sees the object below again (zeroes for anonymous memory). Pages of
+ * shared mappings stay cached.
+ *
+ * After a fork the objects below the area's own may hold copies made
+ * before it, which this leaves alone; do_madvise clears them for
+ * anonymous areas with madvise_zero. A private file mapping then sees
+ * its pre-fork copies rather than the file, unlike Linux.
+ */
+void
+madvise_dontneed(vmarea_t *vma, uint32_t lopage, uint32_t hipage, int cause)
+{
+	mmobj_t* topObj = vma->vma_obj;
+	pframe_t* tempFrame = NULL;
+	uint32_t pagenum = vma->vma_off + lopage - vma->vma_start;
+	uint32_t npages = hipage - lopage;
+	tlb_batch_t tb;
+
+	tlb_batch_init(&tb, cause);
+	vmarea_unmap(vma, lopage, hipage, &tb);
+	tlb_batch_finish(&tb);
+
+	if(!(MAP_PRIVATE & vma->vma_flags))
+		return;
+
+again:
+	list_iterate_begin(&topObj->mmo_respages, tempFrame, pframe_t, pf_olink)
+	{
+		if(tempFrame->pf_pagenum - pagenum >= npages)
+			continue;
+		if(pframe_is_busy(tempFrame))
+		{
+			sched_sleep_on(&tempFrame->pf_waitq);
+			goto again;
+		}
+		while(pframe_is_pinned(tempFrame))
+			pframe_unpin(tempFrame);
+		pframe_clear_dirty(tempFrame);
+		pframe_free(tempFrame);
+		goto again;
+	}list_iterate_end();
+
+	swap_drop_range(topObj, pagenum, npages);
+}
+
+/*
+ * Makes pages [lopage, hipage) of private area vma read as zeroes. A
+ * page which some object of the area's shadow chain holds, resident or
+ * swapped out, is brought into the area's own object and cleared; the
+ * others read as zeroes already. Returns 0, or -ENOMEM (pages before
+ * the one which failed are cleared).
+ */
+int
+madvise_zero(vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+	mmobj_t* topObj = vma->vma_obj;
+	mmobj_t* o = NULL;
+	pframe_t* tempFrame = NULL;
+	uint32_t pagenum = vma->vma_off + lopage - vma->vma_start;
+	uint32_t endpage = pagenum + hipage - lopage;
+	int retVal = 0;
+
+	KASSERT(MAP_PRIVATE & vma->vma_flags);
+	for(; pagenum < endpage; pagenum++)
+	{
+		for(o = topObj; NULL != o; o = o->mmo_shadowed)
+			if((NULL != pframe_get_resident(o, pagenum)) || swap_has(o, pagenum))
+				break;
+		if(NULL == o)
+			continue;
+
+		/* copies the page up into topObj, or swaps it in; may sleep */
+		if(0 > (retVal = pframe_get(topObj, pagenum, &tempFrame)))
+			return retVal;
+		memset(tempFrame->pf_addr, 0, PAGE_SIZE);
+		pframe_dirty(tempFrame);
+	}
+	return 0;
+}
+
+/* Returns 1 if vma is private anonymous memory. */
+static int
+madvise_area_is_anon(vmarea_t *vma)
+{
+	mmobj_t* bottom = vma->vma_obj;
+
+	if(NULL != bottom->mmo_shadowed)
+		bottom = bottom->mmo_un.mmo_bottom_obj;
+	return (MAP_PRIVATE & vma->vma_flags) && mmobj_is_anon(bottom);
+}
+
+/*
+ * This function implements the madvise(2) syscall.
+ *
+ * MADV_WILLNEED queues the range for readaheadd and returns at once,
+ * MADV_DONTNEED drops it (see madvise_dontneed) and clears what
+ * anonymous areas still share with the other side of a fork, so that
+ * they read zeroes as in Linux. MADV_NORMAL,
+ * MADV_RANDOM and MADV_SEQUENTIAL set the access pattern of every
+ * area the range touches; areas are not split for this.
+ *
+ * Returns -ENOMEM if part of the range is not mapped.
+ */
+int
+do_madvise(void *addr, size_t len, int advice)
+{
+	vmarea_t* vmArea = NULL;
+	uint32_t lopage, hipage, vfn, endvfn;
+	int retVal = 0;
+
+	if(!(PAGE_ALIGNED(addr)))
+		return -EINVAL;
+	if((MADV_NORMAL > advice) || (MADV_DONTNEED < advice))
+		return -EINVAL;
+	if(0 == len)
+		return 0;
+	if(!(PAGE_ALIGNED(len))){
+		len = (uint32_t)PN_TO_ADDR(ADDR_TO_PN(len)+1);
+	}
+	if(((uint32_t)addr < USER_MEM_LOW) || ((uint32_t)addr > USER_MEM_HIGH)
+	   || (len > USER_MEM_HIGH - (uint32_t)addr))
+		return -EINVAL;
+
+	lopage = ADDR_TO_PN(addr);
+	hipage = ADDR_TO_PN((uint32_t)addr + len);
+
+	for(vfn = lopage; vfn < hipage; vfn = endvfn)
+	{
+		if(NULL == (vmArea = vmmap_lookup(curproc->p_vmmap, vfn)))
+			return -ENOMEM;
+		endvfn = MIN(hipage, vmArea->vma_end);
+
+		switch(advice)
+		{
+		case MADV_WILLNEED:
+			readahead(vmArea->vma_obj, vmArea->vma_off + vfn - vmArea->vma_start, endvfn - vfn);
+			break;
+		case MADV_DONTNEED:
+			madvise_dontneed(vmArea, vfn, endvfn, TLB_MADVISE);
+			if(madvise_area_is_anon(vmArea)
+			   && (0 > (retVal = madvise_zero(vmArea, vfn, endvfn))))
+				return retVal;
+			break;
+		default:
+			vmarea_set_advice(vmArea, advice);
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * This function implements the mremap(2) syscall, without MREMAP_FIXED.
+ *
+ * [oldaddr, oldaddr + oldlen) must lie within a single mapping. Shrinking
+ * unmaps the tail. Growing extends the area in place if the pages after
+ * it are free; otherwise, with MREMAP_MAYMOVE, the range is split off
+ * into an area of its own and moved to a free range, taking its object
+ * and its resident pages along, so nothing is copied. The brk heap
+ * cannot be remapped.
+ *
+ * An area only grows over object pages nobody else maps and which hold
+ * nothing left over (see vmmap_area_growable). Otherwise the new pages
+ * are mapped as a separate area after it, with objects of their own,
+ * so they read as zeroes (or as the file) like any new mapping.
+ *
+ * The address of the mapping is "returned" through ret.
+ * Returns 0 on success, -errno on failure.
+ */
+int
+do_mremap(void *oldaddr, size_t oldlen, size_t newlen, int flags, void **ret)
+{
+	vmmap_t* map = curproc->p_vmmap;
+	vmarea_t* vmArea = NULL;
+	uint32_t lopage, oldhi, newhi;
+	int newlo, err;
+
+	if(!(PAGE_ALIGNED(oldaddr)))
+		return -EINVAL;
+	if(flags & ~MREMAP_MAYMOVE)
+		return -EINVAL;
+	if((0 == oldlen) || (0 == newlen))
+		return -EINVAL;
+	if(!(PAGE_ALIGNED(oldlen)))
+		oldlen = (uint32_t)PN_TO_ADDR(ADDR_TO_PN(oldlen)+1);
+	if(!(PAGE_ALIGNED(newlen)))
+		newlen = (uint32_t)PN_TO_ADDR(ADDR_TO_PN(newlen)+1);
+	if(((uint32_t)oldaddr < USER_MEM_LOW) || ((uint32_t)oldaddr > USER_MEM_HIGH)
+	   || (oldlen > USER_MEM_HIGH - (uint32_t)oldaddr)
+	   || (newlen > USER_MEM_HIGH - USER_MEM_LOW))
+		return -EINVAL;
+
+	lopage = ADDR_TO_PN(oldaddr);
+	oldhi = lopage + ADDR_TO_PN(oldlen);
+	newhi = lopage + ADDR_TO_PN(newlen);
+
+	vmArea = vmmap_lookup(map, lopage);
+	if((NULL == vmArea) || (oldhi > vmArea->vma_end))
+		return -EFAULT;
+	if(vmArea == vmmap_heap(map))
+		return -EINVAL;
+
+	*ret = oldaddr;
+	if(newhi == oldhi)
+		return 0;
+	if(newhi < oldhi)
+	{
+		vmmap_remove(map, newhi, oldhi - newhi);
+		return 0;
+	}
+
+	/* grow in place */
+	if((oldhi == vmArea->vma_end) && (newhi <= ADDR_TO_PN(USER_MEM_HIGH))
+	   && vmmap_is_range_empty(map, oldhi, newhi - oldhi))
+	{
+		if(!vmmap_area_growable(vmArea, newhi - oldhi))
+			return vmmap_map_past(map, vmArea, oldhi, newhi - oldhi);
+		vmArea->vma_end = newhi;
+		vmmap_area_resized(map, vmArea);
+		return 0;
+	}
+
+	if(!(MREMAP_MAYMOVE & flags))
+		return -ENOMEM;
+	if(0 > (newlo = vmmap_find_range(map, newhi - lopage, VMMAP_DIR_LOHI)))
+		return -ENOMEM;
+	if(NULL == (vmArea = vmmap_isolate(map, lopage, oldhi)))
+		return -ENOMEM;
+
+	if(vmmap_area_growable(vmArea, newhi - oldhi))
+		vmmap_move(map, vmArea, newlo, newhi - lopage);
+	else
+	{
+		/* e.g. the rest of the area it was split from maps those pages */
+		if(0 > (err = vmmap_map_past(map, vmArea, newlo + oldhi - lopage, newhi - oldhi)))
+			return err;
+		vmmap_move(map, vmArea, newlo, oldhi - lopage);
+	}
+	*ret = PN_TO_ADDR(newlo);
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include "util/debug.h"
 
 #include "proc/proc.h"
+#include "proc/procstat.h"
 
 #include "mm/mm.h"
 #include "mm/mman.h"
@@ -16,7 +17,343 @@
 
 #include "vm/pagefault.h"
 #include "vm/vmmap.h"
+#include "vm/vmmapext.h"
+#include "vm/madvise.h"
+#include "vm/readahead.h"
+#include "vm/brkheap.h"
+#include "vm/mremap.h"
+#include "vm/largemap.h"
+#include "vm/anonmem.h"
+#include "vm/swap.h"
 #include "api/access.h"
+#include "api/uaccess.h"
+
+/*
+ * Returns 1 if no object in the chain starting at 'o' has page 'pagenum'
+ * resident or paged out, i.e. a read of that page would only ever see zeroes.
+ * Does not block.
+ */
+static int
+pagefault_chain_untouched(mmobj_t *o, uint32_t pagenum)
+{
+  mmobj_t* obj = o;
+  for( ; NULL != obj; obj = obj->mmo_shadowed)
+    {
+      if(NULL != pframe_get_resident(obj, pagenum))
+        return 0;
+      if(swap_has(obj, pagenum))
+        return 0;
+    }
+  return 1;
+}
+
+/*
+ * Read faults on private anonymous memory which has never been written
+ * are satisfied by mapping the shared zero page read-only. The first
+ * write fault then allocates a real frame through the normal path.
+ * Returns 1 if the zero page was mapped.
+ */
+static int
+pagefault_map_zeropage(vmarea_t *vma, uintptr_t vaddr, uint32_t cause)
+{
+  mmobj_t* bottom = NULL;
+  uint32_t pagenum = vma->vma_off + ADDR_TO_PN(vaddr) - vma->vma_start;
+
+  if(FAULT_WRITE & cause)
+    return 0;
+  if(!(MAP_PRIVATE & vma->vma_flags))
+    return 0;
+
+  bottom = vma->vma_obj;
+  if(NULL != bottom->mmo_shadowed)
+    bottom = bottom->mmo_un.mmo_bottom_obj;
+  if(!mmobj_is_anon(bottom))
+    return 0;
+
+  if(!pagefault_chain_untouched(vma->vma_obj, pagenum))
+    return 0;
+
+  pt_map(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(ADDR_TO_PN(vaddr)),
+         pt_virt_to_phys((uint32_t)anon_zeropage()),
+         PD_WRITE | PD_PRESENT | PD_USER, PT_PRESENT | PT_USER);
+  vmarea_mapped(vma, ADDR_TO_PN(vaddr), ADDR_TO_PN(vaddr) + 1);
+  anon_zeropage_faults++;
+  return 1;
+}
+
+/*
+ * Finds the page frame backing virtual page vfn of vma, copying it up
+ * into the top shadow object first if forwrite, and maps it. Returns 0
+ * on success, -errno if the page could not be brought in.
+ */
+static int
+pagefault_map_page(vmarea_t *vma, uint32_t vfn, int forwrite)
+{
+  pframe_t* tempPageframe = NULL;
+  uint32_t pagenum = vma->vma_off + vfn - vma->vma_start;
+  uint32_t pageTableFlags = PT_PRESENT | PT_USER;
+  int retVal = 0;
+
+  if(NULL == vma->vma_obj->mmo_shadowed)
+    retVal = pframe_get(vma->vma_obj, pagenum, &tempPageframe);
+  else
+    retVal = vma->vma_obj->mmo_ops->lookuppage(vma->vma_obj, pagenum, forwrite, &tempPageframe);
+  if(0 > retVal)
+    return retVal;
+
+  if(forwrite)
+    {
+      /* the page is about to be modified through the mapping; anonymous
+       * pages need this to be written to swap before being reclaimed */
+      pframe_dirty(tempPageframe);
+      pageTableFlags = PT_WRITE | pageTableFlags;
+    }
+
+  pt_map(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(vfn), pt_virt_to_phys((uint32_t)tempPageframe->pf_addr), PD_WRITE | PD_PRESENT | PD_USER, pageTableFlags);
+  vmarea_mapped(vma, vfn, vfn + 1);
+  return 0;
+}
+
+/*
+ * Faults in and maps pages [lopage, lopage + npages) of vma up front,
+ * for MAP_POPULATE. Private writable pages are brought in as if
+ * written to, so that they do not take a copy-on-write fault later;
+ * shared ones are mapped read-only so the first write still dirties
+ * the page. Returns 0 on success, -errno on failure.
+ */
+int
+pagefault_populate(vmarea_t *vma, uint32_t lopage, uint32_t npages)
+{
+  uint32_t vfn = 0;
+  int forwrite = (PROT_WRITE & vma->vma_prot) && (MAP_PRIVATE & vma->vma_flags);
+  int retVal = 0;
+
+  KASSERT((vma->vma_start <= lopage) && (lopage + npages <= vma->vma_end));
+  if(PROT_NONE == vma->vma_prot)
+    return 0;
+
+  for(vfn = lopage; vfn < lopage + npages; vfn++)
+    {
+      if(0 > (retVal = pagefault_map_page(vma, vfn, forwrite)))
+        return retVal;
+    }
+  return 0;
+}
+
+/* fault-around window in pages, a power of two */
+#define FAULTAROUND_PAGES 16
+
+/*
+ * Returns the page frame backing page 'pagenum' of 'vma' if it can be
+ * mapped read-only right now: it is resident and not busy in some
+ * object of the chain, and no object above that one has the page
+ * paged out. In a writable area pages of the top object are skipped,
+ * they may already be mapped read-write. Does not block.
+ */
+static pframe_t*
+pagefault_resident_ro(vmarea_t *vma, uint32_t pagenum)
+{
+  mmobj_t* obj = vma->vma_obj;
+  pframe_t* pf = NULL;
+  for( ; NULL != obj; obj = obj->mmo_shadowed)
+    {
+      if(NULL != (pf = pframe_get_resident(obj, pagenum)))
+        {
+          if(pframe_is_busy(pf))
+            return NULL;
+          if((PROT_WRITE & vma->vma_prot) && (obj == vma->vma_obj))
+            return NULL;
+          return pf;
+        }
+      if(swap_has(obj, pagenum))
+        return NULL;
+    }
+  return NULL;
+}
+
+/*
+ * Returns the resident, non-busy page a fault on page 'pagenum' of vma
+ * would map, or NULL if that page would have to be brought in first.
+ * Does not block.
+ */
+static pframe_t*
+pagefault_resident(vmarea_t *vma, uint32_t pagenum)
+{
+  mmobj_t* obj = vma->vma_obj;
+  pframe_t* pf = NULL;
+
+  for( ; NULL != obj; obj = obj->mmo_shadowed)
+    {
+      if(NULL != (pf = pframe_get_resident(obj, pagenum)))
+        return pframe_is_busy(pf) ? NULL : pf;
+      if(swap_has(obj, pagenum))
+        return NULL;
+    }
+  return NULL;
+}
+
+/*
+ * Returns 1 if pf, resident for vma, may be written through without a
+ * fault: a dirty page the area writes to directly (its own copy, or a
+ * page of a shared mapping).
+ */
+static int
+pagefault_writable(vmarea_t *vma, pframe_t *pf)
+{
+  return (PROT_WRITE & vma->vma_prot) && pframe_is_dirty(pf)
+    && ((pf->pf_obj == vma->vma_obj) || (MAP_SHARED & vma->vma_flags));
+}
+
+/*
+ * Returns the page backing vfn of vma if a fault on it would just map
+ * the resident page (for a write, a writable one as above), NULL if the
+ * fault would have to do any work. Used by the user copy fast path.
+ * Does not block.
+ */
+pframe_t*
+pagefault_peek(vmarea_t *vma, uint32_t vfn, int forwrite)
+{
+  pframe_t* pf = pagefault_resident(vma, vma->vma_off + vfn - vma->vma_start);
+
+  if((NULL != pf) && forwrite && !pagefault_writable(vma, pf))
+    return NULL;
+  return pf;
+}
+
+/*
+ * Maps the page backing vfn of vma if it is resident, without faulting
+ * it in: writable if pagefault_writable allows it, read-only otherwise,
+ * so that the first write still goes through the fault handler. Used
+ * by mremap to carry mappings over to the new address. Returns 1 if
+ * the page was mapped. Does not block.
+ */
+int
+pagefault_map_resident(vmarea_t *vma, uint32_t vfn)
+{
+  pframe_t* pf = NULL;
+  uint32_t pageTableFlags = PT_PRESENT | PT_USER;
+
+  if(!((PROT_READ | PROT_WRITE | PROT_EXEC) & vma->vma_prot))
+    return 0;
+  if(NULL == (pf = pagefault_resident(vma, vma->vma_off + vfn - vma->vma_start)))
+    return 0;
+
+  if(pagefault_writable(vma, pf))
+    pageTableFlags = PT_WRITE | pageTableFlags;
+
+  pt_map(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(vfn), pt_virt_to_phys((uint32_t)pf->pf_addr),
+         PD_WRITE | PD_PRESENT | PD_USER, pageTableFlags);
+  vmarea_mapped(vma, vfn, vfn + 1);
+  return 1;
+}
+
+uint32_t largemap_nahead = 0;
+
+int
+largemap_enabled(void)
+{
+#ifdef __LARGEMAP__
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * After a minor read fault on vfn, maps the resident pages of the
+ * LARGEMAP_NPAGES window around it; see vm/largemap.h. Returns 0,
+ * leaving the small window to pagefault_map_around, if the area's
+ * objects do not hold more pages than that would cover.
+ */
+static int
+pagefault_map_large(vmarea_t *vma, uint32_t vfn)
+{
+  uint32_t start = vfn & ~(LARGEMAP_NPAGES - 1);
+  uint32_t end = start + LARGEMAP_NPAGES;
+  uint32_t vpn = 0;
+  uint32_t nres = 0;
+  mmobj_t* obj = NULL;
+
+  for(obj = vma->vma_obj; NULL != obj; obj = obj->mmo_shadowed)
+    nres += obj->mmo_nrespages;
+  if(nres <= FAULTAROUND_PAGES)
+    return 0;
+
+  if(start < vma->vma_start)
+    start = vma->vma_start;
+  if(end > vma->vma_end)
+    end = vma->vma_end;
+
+  for(vpn = start; vpn < end; vpn++)
+    {
+      if((vfn != vpn) && pagefault_map_resident(vma, vpn))
+        largemap_nahead++;
+    }
+  return 1;
+}
+
+/*
+ * After a read fault, maps the other pages of the aligned
+ * FAULTAROUND_PAGES window around 'vaddr' which are already resident,
+ * e.g. the text of a binary another process has paged in, so that
+ * each of them does not take a fault of its own.
+ */
+static void
+pagefault_map_around(vmarea_t *vma, uintptr_t vaddr)
+{
+  uint32_t vfn = ADDR_TO_PN(vaddr);
+  uint32_t start = vfn & ~(FAULTAROUND_PAGES - 1);
+  uint32_t end = start + FAULTAROUND_PAGES;
+  uint32_t vpn = 0;
+  pframe_t* pf = NULL;
+
+  if(start < vma->vma_start)
+    start = vma->vma_start;
+  if(end > vma->vma_end)
+    end = vma->vma_end;
+
+  for(vpn = start; vpn < end; vpn++)
+    {
+      if(vfn == vpn)
+        continue;
+      pf = pagefault_resident_ro(vma, vma->vma_off + vpn - vma->vma_start);
+      if(NULL == pf)
+        continue;
+      pt_map(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(vpn),
+             pt_virt_to_phys((uint32_t)pf->pf_addr),
+             PD_WRITE | PD_PRESENT | PD_USER, PT_PRESENT | PT_USER);
+      vmarea_mapped(vma, vpn, vpn + 1);
+      proc_stats(curproc)->ps_nfaultaround++;
+    }
+}
+
+/*
+ * Fault in an area advised MADV_SEQUENTIAL: have readaheadd bring in
+ * the window after vfn, and let the page a window behind be reclaimed
+ * before others.
+ */
+static void
+pagefault_sequential(vmarea_t *vma, uint32_t vfn)
+{
+  uint32_t end = MIN(vfn + 1 + READAHEAD_WINDOW, vma->vma_end);
+  mmobj_t* obj = NULL;
+  pframe_t* pf = NULL;
+
+  if(vfn + 1 < end)
+    readahead(vma->vma_obj, vma->vma_off + vfn + 1 - vma->vma_start, end - vfn - 1);
+
+  if(vfn < vma->vma_start + READAHEAD_WINDOW)
+    return;
+  for(obj = vma->vma_obj; NULL != obj; obj = obj->mmo_shadowed)
+    {
+      pf = pframe_get_resident(obj, vma->vma_off + vfn - READAHEAD_WINDOW - vma->vma_start);
+      if(NULL != pf)
+        {
+          pframe_deactivate(pf);
+          return;
+        }
+    }
+}
 
 /*
  * This gets called by _pt_fault_handler in mm/pagetable.c The
@@ -43,6 +380,13 @@
  * Finally call pt_map to have the new mapping placed into the
  * appropriate page table.
  *
+ * Read faults on untouched private anonymous pages map the shared
+ * zero page instead of allocating a frame (see pagefault_map_zeropage).
+ * Other read faults also map the resident pages around the faulting
+ * one (see pagefault_map_around, and pagefault_map_large for the
+ * wider window LARGEMAP gives minor faults), unless the area was
+ * advised MADV_RANDOM; faults in MADV_SEQUENTIAL areas start readahead.
+ *
  * @param vaddr the address that was accessed to cause the fault
  *
  * @param cause this is the type of operation on the memory
@@ -54,10 +398,16 @@ handle_pagefault(uintptr_t vaddr, uint32_t cause)
 {
 
   int accessRight = 0;
-  pframe_t* tempPageframe = NULL;
+  int advice = MADV_NORMAL;
+  int minor = 0;
+  uint32_t vfn = 0;
+
+  proc_stats(curproc)->ps_nfaults++;
+  if(pframe_memory_low())
+    brk_release_reserve();
   
   vmarea_t* area_lookup = vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(vaddr));
-  if(NULL == area_lookup)
+  if((NULL == area_lookup) || brk_in_reserve(area_lookup, ADDR_TO_PN(vaddr)))
     {
       
       curproc->p_status = EFAULT;
@@ -82,24 +432,24 @@ handle_pagefault(uintptr_t vaddr, uint32_t cause)
       return;
     }
 
-  uint32_t pageTableFlags = 0;
-  
-  if(0 == area_lookup->vma_obj->mmo_shadowed)
-    {
-      
-      pframe_get( area_lookup->vma_obj,  area_lookup->vma_off + ADDR_TO_PN(vaddr) - area_lookup->vma_start, &tempPageframe);
-    }
-  
-  else
+  if(pagefault_map_zeropage(area_lookup, vaddr, cause))
+    return;
+
+  vfn = ADDR_TO_PN(vaddr);
+  advice = vmarea_advice(area_lookup);
+  if(largemap_enabled() && !(FAULT_WRITE & cause) && (MADV_RANDOM != advice))
+    minor = (NULL != pagefault_resident(area_lookup, area_lookup->vma_off + vfn - area_lookup->vma_start));
+
+  if(0 > pagefault_map_page(area_lookup, vfn, FAULT_WRITE & cause))
     {
-  
-  
-      area_lookup->vma_obj->mmo_ops->lookuppage(area_lookup->vma_obj,  area_lookup->vma_off + ADDR_TO_PN(vaddr) - area_lookup->vma_start , FAULT_WRITE & cause, &tempPageframe);
-  
+      curproc->p_status = EFAULT;
+      kthread_exit(&curproc->p_status);
+      return;
     }
-   pageTableFlags = PT_PRESENT | PT_USER;
-  if(FAULT_WRITE & cause)
-      pageTableFlags = PT_WRITE | pageTableFlags;
-  		  
-  pt_map(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(ADDR_TO_PN(vaddr)), pt_virt_to_phys((uint32_t)tempPageframe->pf_addr), PD_WRITE | PD_PRESENT | PD_USER, pageTableFlags);
+
+  if(!(FAULT_WRITE & cause) && (MADV_RANDOM != advice)
+     && !(minor && pagefault_map_large(area_lookup, vfn)))
+    pagefault_map_around(area_lookup, vaddr);
+  if(MADV_SEQUENTIAL == advice)
+    pagefault_sequential(area_lookup, ADDR_TO_PN(vaddr));
   }
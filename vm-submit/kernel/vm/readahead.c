@@ -0,0 +1,167 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/debug.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/page.h"
+
+#include "vm/anonmem.h"
+#include "vm/swap.h"
+#include "vm/readahead.h"
+
+/*
+ * Readahead daemon.
+ *
+ * readahead() queues a range of pages of an object and returns right
+ * away; readaheadd brings the pages in with pframe_get, so that the
+ * faults which follow find them resident. For a shadow chain only the
+ * page a fault would end up reading is brought in: the file page at
+ * the bottom, or a page paged out to swap somewhere in the chain.
+ *
+ * Each queued request holds a reference on its object.
+ */
+
+typedef struct readahead_req {
+        mmobj_t      *rr_obj;
+        uint32_t      rr_pagenum;
+        uint32_t      rr_npages;
+} readahead_req_t;
+
+static readahead_req_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static int readahead_head = 0;
+static int readahead_count = 0;
+
+static proc_t *readaheadd = NULL;
+static kthread_t *readaheadd_thr = NULL;
+static ktqueue_t readaheadd_waitq;
+static int readaheadd_exiting = 0;
+
+uint32_t readahead_nqueued = 0;
+uint32_t readahead_ndropped = 0;
+uint32_t readahead_npages = 0;
+
+/*
+ * Asks readaheadd to bring pages [pagenum, pagenum + npages) of 'o' in.
+ * Does not block.
+ */
+void
+readahead(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        readahead_req_t *req;
+
+        if ((NULL == readaheadd_thr) || readaheadd_exiting || (0 == npages))
+                return;
+        if (READAHEAD_QUEUE_SIZE == readahead_count) {
+                readahead_ndropped++;
+                return;
+        }
+
+        req = &readahead_queue[(readahead_head + readahead_count) % READAHEAD_QUEUE_SIZE];
+        o->mmo_ops->ref(o);
+        req->rr_obj = o;
+        req->rr_pagenum = pagenum;
+        req->rr_npages = npages;
+        readahead_count++;
+        readahead_nqueued++;
+
+        sched_broadcast_on(&readaheadd_waitq);
+}
+
+/* brings in the one page of the chain below 'o' a fault would read */
+static void
+readahead_page(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf;
+
+        for ( ; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != pframe_get_resident(o, pagenum))
+                        return;
+                if (swap_has(o, pagenum)
+                    || ((NULL == o->mmo_shadowed) && !mmobj_is_anon(o))) {
+                        if (0 == pframe_get(o, pagenum, &pf))
+                                readahead_npages++;
+                        return;
+                }
+        }
+}
+
+static void *
+readaheadd_run(int arg1, void *arg2)
+{
+        readahead_req_t req;
+        uint32_t i;
+
+        while (!readaheadd_exiting) {
+                if (0 == readahead_count) {
+                        sched_sleep_on(&readaheadd_waitq);
+                        continue;
+                }
+
+                req = readahead_queue[readahead_head];
+                readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+                readahead_count--;
+
+                for (i = 0; (i < req.rr_npages) && !readaheadd_exiting; ++i) {
+                        if (page_free_count() < READAHEAD_MINFREE)
+                                break;
+                        readahead_page(req.rr_obj, req.rr_pagenum + i);
+                }
+                req.rr_obj->mmo_ops->put(req.rr_obj);
+        }
+
+        /* drop the references of whatever is still queued */
+        while (0 < readahead_count) {
+                req = readahead_queue[readahead_head];
+                readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+                readahead_count--;
+                req.rr_obj->mmo_ops->put(req.rr_obj);
+        }
+        kthread_exit((void *)0);
+        return NULL;
+}
+
+static __attribute__((unused)) void
+readaheadd_init(void)
+{
+        sched_queue_init(&readaheadd_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        readaheadd = proc_create("readaheadd");
+        KASSERT(NULL != readaheadd);
+        readaheadd_thr = kthread_create(readaheadd, readaheadd_run, 0, NULL);
+        KASSERT(NULL != readaheadd_thr);
+
+        sched_make_runnable(readaheadd_thr);
+}
+init_func(readaheadd_init);
+init_depends(sched_init);
+
+/*
+ * Stops readaheadd and waits for it. Called by the idle process before
+ * the file systems are shut down, since queued requests hold references
+ * on file objects.
+ */
+void
+readahead_shutdown(void)
+{
+        int pid, child;
+
+        KASSERT(PID_IDLE == curproc->p_pid);
+        KASSERT(NULL != readaheadd);
+
+        pid = readaheadd->p_pid;
+        readaheadd_exiting = 1;
+        sched_broadcast_on(&readaheadd_waitq);
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than readaheadd");
+        readaheadd = NULL;
+        readaheadd_thr = NULL;
+}
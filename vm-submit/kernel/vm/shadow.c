@@ -14,6 +14,7 @@
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/shadowd.h"
+#include "vm/swap.h"
 
 #define SHADOW_SINGLETON_THRESHOLD 5
 
@@ -132,6 +133,7 @@ shadow_put(mmobj_t *o)
 			/*Check here*/
 		}else{
 			o->mmo_shadowed->mmo_ops->put(o->mmo_shadowed);
+			swap_drop_obj(o);
 			slab_obj_free( shadow_allocator, o);
 		}
 	}
@@ -152,6 +154,7 @@ shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 	mmobj_t* tempObj = o;
 	pframe_t* spframe = NULL;
 	uint32_t flag = 0;
+	int retVal = 0;
 	while(NULL != tempObj->mmo_shadowed){
 		list_iterate_begin(&tempObj->mmo_respages, tpframe, pframe_t, pf_olink) {
 			if(  pagenum == tpframe->pf_pagenum){
@@ -164,11 +167,20 @@ shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 
 		if(0 != flag)
 			break;
+		/* a paged out copy in this object hides the ones below it */
+		if(swap_has(tempObj, pagenum)){
+			/* swapping it in needs a page, which may fail */
+			if(0 > (retVal = pframe_get(tempObj, pagenum, &spframe)))
+				return retVal;
+			flag = 1;
+			break;
+		}
 		tempObj = tempObj->mmo_shadowed;
 	}
 
 	if(0 == flag){
-		pframe_get(o->mmo_un.mmo_bottom_obj, pagenum, &spframe);
+		if(0 > (retVal = pframe_get(o->mmo_un.mmo_bottom_obj, pagenum, &spframe)))
+			return retVal;
 	}
 
 	if(0 == forwrite){
@@ -180,8 +192,7 @@ shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 
 		if(o != spframe->pf_obj){
 
-					pframe_get(o, pagenum, pf);
-					return 0;
+					return pframe_get(o, pagenum, pf);
 
 				}
 				else{
@@ -211,7 +222,14 @@ shadow_fillpage(mmobj_t *o, pframe_t *pf)
 	KASSERT(!pframe_is_pinned(pf));
 	dbg(DBG_ALL, "GRADING3 3.f: pframe is pinned \n");
 
-	pframe_pin(pf);
+	/* without swap there is no other copy of the data, keep it resident */
+	if(!swap_enabled())
+		pframe_pin(pf);
+
+	/* this object's own copy was paged out, no need to copy from below */
+	int retVal = swap_in(pf);
+	if(0 != retVal)
+		return (0 > retVal) ? retVal : 0;
 
 	mmobj_t* tempObj = o->mmo_shadowed;
 	int flag = 0;
@@ -230,10 +248,17 @@ shadow_fillpage(mmobj_t *o, pframe_t *pf)
 
 		if(1 == flag)
 			break;
+		if(swap_has(tempObj, pf->pf_pagenum)){
+			if(0 > (retVal = pframe_get(tempObj, pf->pf_pagenum, &npframe)))
+				return retVal;
+			flag = 1;
+			break;
+		}
 		tempObj = tempObj->mmo_shadowed;
 	}
 	if(0 == flag){
-		pframe_get(tempObj, pf->pf_pagenum, &npframe);
+		if(0 > (retVal = pframe_get(tempObj, pf->pf_pagenum, &npframe)))
+			return retVal;
 	}
 	memcpy(pf->pf_addr, npframe->pf_addr, PAGE_SIZE);
 	return 0;
@@ -246,10 +271,12 @@ shadow_dirtypage(mmobj_t *o, pframe_t *pf)
 	return 0;
 }
 
+/* Cleaning a shadow page writes it out to swap, if there is any. */
 static int
 shadow_cleanpage(mmobj_t *o, pframe_t *pf)
 {
-	/*KASSERT(1);*/
+	if(swap_enabled())
+		return swap_out(pf);
 	return 0;
 }
 
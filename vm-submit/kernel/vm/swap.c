@@ -0,0 +1,374 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/debug.h"
+
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
+
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "vm/swap.h"
+#include "vm/zpool.h"
+
+/*
+ * Swap space for anonymous memory.
+ *
+ * Anonymous and shadow objects have no backing store of their own, so
+ * when pageoutd wants to reclaim one of their dirty pages, the page is
+ * written to a slot on the swap disk. A page which is not resident has
+ * no pframe_t to note the slot in, so the slots of non-resident pages
+ * are kept in a hash table keyed on (object, pagenum), the same
+ * identity the resident page hash uses.
+ *
+ * With ZRAM enabled pages are first compressed into the in-memory pool
+ * (see zpool.c), and only go to disk when they do not compress well or
+ * the pool is full. An entry holds the page in exactly one of the two
+ * places.
+ *
+ * A disk entry stays valid after the page is read back in; if the page
+ * is evicted again without being dirtied nothing needs to be written.
+ * A compressed copy is dropped as soon as it is read back, since it
+ * holds on to memory, and the page is marked dirty so that it is
+ * stored again before it is reclaimed. The slots of an object are
+ * released when the object itself is freed.
+ */
+
+#define SWAP_NOSLOT ((uint32_t)-1)
+
+typedef struct swap_entry {
+        mmobj_t      *se_obj;
+        uint32_t      se_pagenum;
+        uint32_t      se_slot;   /* disk slot, or SWAP_NOSLOT */
+        void         *se_zdata;  /* compressed copy, or NULL */
+        uint32_t      se_zlen;
+        list_link_t   se_link;
+} swap_entry_t;
+
+#define hash_swap(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) \
+                                  % SWAP_HASH_SIZE)
+
+static list_t swap_hash[SWAP_HASH_SIZE];
+static uint32_t swap_nentries = 0;
+
+/* one bit per slot, set when the slot is in use */
+static uint32_t swap_bitmap[SWAP_NSLOTS / 32];
+static uint32_t swap_rotor = 0;
+
+static blockdev_t *swap_bdev = NULL;
+static slab_allocator_t *swap_entry_allocator = NULL;
+
+uint32_t swap_nout = 0;
+uint32_t swap_nin = 0;
+uint32_t swap_nslots_used = 0;
+
+static inline uint32_t
+swap_rdtsc(void)
+{
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return lo;
+}
+
+void
+swap_init(void)
+{
+        int i;
+        for (i = 0; i < SWAP_HASH_SIZE; ++i)
+                list_init(&swap_hash[i]);
+        memset(swap_bitmap, 0, sizeof(swap_bitmap));
+
+        swap_entry_allocator = slab_allocator_create("swap entry", sizeof(swap_entry_t));
+        KASSERT(NULL != swap_entry_allocator);
+
+#ifdef __SWAP__
+        swap_bdev = blockdev_lookup(SWAP_DEVID);
+        if (NULL == swap_bdev)
+                dbg(DBG_PFRAME, "swap: no swap disk\n");
+#endif
+}
+init_func(swap_init);
+
+/*
+ * Returns 1 if anonymous pages can be paged out (to disk or to the
+ * compressed pool), 0 if they must stay pinned in memory.
+ */
+int
+swap_enabled(void)
+{
+        return (NULL != swap_bdev) || zpool_enabled();
+}
+
+/*
+ * Next-fit search of the slot bitmap starting at the rotor. Returns
+ * the slot number or -ENOSPC.
+ */
+static int
+swap_slot_alloc(void)
+{
+        uint32_t n, slot;
+
+        for (n = 0; n < SWAP_NSLOTS; ++n) {
+                slot = (swap_rotor + n) % SWAP_NSLOTS;
+                if (0xffffffff == swap_bitmap[slot / 32]) {
+                        /* skip the rest of a full word */
+                        n += 31 - (slot % 32);
+                        continue;
+                }
+                if (!(swap_bitmap[slot / 32] & (1 << (slot % 32)))) {
+                        swap_bitmap[slot / 32] |= (1 << (slot % 32));
+                        swap_rotor = slot + 1;
+                        swap_nslots_used++;
+                        return slot;
+                }
+        }
+        return -ENOSPC;
+}
+
+static void
+swap_slot_free(uint32_t slot)
+{
+        KASSERT(slot < SWAP_NSLOTS);
+        KASSERT(swap_bitmap[slot / 32] & (1 << (slot % 32)));
+        swap_bitmap[slot / 32] &= ~(1 << (slot % 32));
+        swap_nslots_used--;
+}
+
+static swap_entry_t *
+swap_lookup(mmobj_t *o, uint32_t pagenum)
+{
+        swap_entry_t *se;
+        list_iterate_begin(&swap_hash[hash_swap(o, pagenum)], se, swap_entry_t, se_link) {
+                if ((o == se->se_obj) && (pagenum == se->se_pagenum))
+                        return se;
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Returns 1 if page 'pagenum' of 'o' has a copy in swap. Does not block.
+ */
+int
+swap_has(mmobj_t *o, uint32_t pagenum)
+{
+        if (0 == swap_nentries)
+                return 0;
+        return (NULL != swap_lookup(o, pagenum));
+}
+
+static void
+swap_entry_free(swap_entry_t *se)
+{
+        list_remove(&se->se_link);
+        if (SWAP_NOSLOT != se->se_slot)
+                swap_slot_free(se->se_slot);
+        if (NULL != se->se_zdata)
+                zpool_free(se->se_zdata, se->se_zlen);
+        slab_obj_free(swap_entry_allocator, se);
+        swap_nentries--;
+}
+
+/*
+ * Returns 1 if any of the npages pages of 'o' starting at 'pagenum'
+ * has a copy in swap. Does not block.
+ */
+int
+swap_has_range(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        swap_entry_t *se;
+        uint32_t i;
+
+        if (0 == swap_nentries)
+                return 0;
+        if (npages <= SWAP_HASH_SIZE) {
+                for (i = 0; i < npages; ++i) {
+                        if (NULL != swap_lookup(o, pagenum + i))
+                                return 1;
+                }
+                return 0;
+        }
+        for (i = 0; i < SWAP_HASH_SIZE; ++i) {
+                list_iterate_begin(&swap_hash[i], se, swap_entry_t, se_link) {
+                        if ((o == se->se_obj) && (se->se_pagenum - pagenum < npages))
+                                return 1;
+                } list_iterate_end();
+        }
+        return 0;
+}
+
+/*
+ * Writes the contents of pf to swap: compressed into the pool if it
+ * will take it, otherwise to disk, reusing the slot of an earlier copy
+ * of the same page if there is one. Called from the cleanpage entry
+ * point of anonymous and shadow objects, so pf is busy.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+int
+swap_out(pframe_t *pf)
+{
+        swap_entry_t *se;
+        void *zdata = NULL;
+        uint32_t zlen = 0;
+        int slot, ret;
+
+        KASSERT(pframe_is_busy(pf));
+
+        if (zpool_enabled())
+                zdata = zpool_store(pf->pf_addr, &zlen);
+        if ((NULL == zdata) && (NULL == swap_bdev))
+                return -ENOSPC;
+
+        if (NULL == (se = swap_lookup(pf->pf_obj, pf->pf_pagenum))) {
+                if (NULL == (se = slab_obj_alloc(swap_entry_allocator))) {
+                        if (NULL != zdata)
+                                zpool_free(zdata, zlen);
+                        return -ENOMEM;
+                }
+                se->se_obj = pf->pf_obj;
+                se->se_pagenum = pf->pf_pagenum;
+                se->se_slot = SWAP_NOSLOT;
+                se->se_zdata = NULL;
+                se->se_zlen = 0;
+                list_insert_head(&swap_hash[hash_swap(pf->pf_obj, pf->pf_pagenum)], &se->se_link);
+                swap_nentries++;
+        }
+
+        if (NULL != se->se_zdata) {
+                zpool_free(se->se_zdata, se->se_zlen);
+                se->se_zdata = NULL;
+        }
+
+        if (NULL != zdata) {
+                /* the disk copy, if any, is stale now */
+                if (SWAP_NOSLOT != se->se_slot) {
+                        swap_slot_free(se->se_slot);
+                        se->se_slot = SWAP_NOSLOT;
+                }
+                dbg(DBG_PFRAME, "swap: page %d of obj %p compressed to %d bytes\n",
+                    pf->pf_pagenum, pf->pf_obj, zlen);
+                se->se_zdata = zdata;
+                se->se_zlen = zlen;
+                swap_nout++;
+                return 0;
+        }
+
+        if (SWAP_NOSLOT == se->se_slot) {
+                if (0 > (slot = swap_slot_alloc())) {
+                        swap_entry_free(se);
+                        return slot;
+                }
+                se->se_slot = slot;
+        }
+
+        dbg(DBG_PFRAME, "swap: page %d of obj %p out to slot %d\n",
+            pf->pf_pagenum, pf->pf_obj, se->se_slot);
+        ret = swap_bdev->bd_ops->write_block(swap_bdev, pf->pf_addr, se->se_slot, 1);
+        if (0 > ret) {
+                swap_entry_free(se);
+                return ret;
+        }
+
+        swap_nout++;
+        return 0;
+}
+
+/*
+ * Fills pf from swap if its page has been paged out. Called from the
+ * fillpage entry point of anonymous and shadow objects.
+ *
+ * Returns 1 if the page was read from swap, 0 if there is no copy in
+ * swap (the caller fills the page itself) and -errno on I/O errors.
+ */
+int
+swap_in(pframe_t *pf)
+{
+        swap_entry_t *se;
+        uint32_t start, cycles;
+        int ret;
+
+        if (0 == swap_nentries)
+                return 0;
+        if (NULL == (se = swap_lookup(pf->pf_obj, pf->pf_pagenum)))
+                return 0;
+
+        if (NULL != se->se_zdata) {
+                start = swap_rdtsc();
+                ret = zpool_load(se->se_zdata, se->se_zlen, pf->pf_addr);
+                cycles = swap_rdtsc() - start;
+                if (0 > ret)
+                        return ret;
+
+                /* running average over the last 16 or so hits */
+                zpool_nhits++;
+                if (1 == zpool_nhits)
+                        zpool_hit_cycles = cycles;
+                else
+                        zpool_hit_cycles = zpool_hit_cycles - zpool_hit_cycles / 16 + cycles / 16;
+
+                swap_entry_free(se);
+                pframe_set_dirty(pf);
+                swap_nin++;
+                return 1;
+        }
+
+        dbg(DBG_PFRAME, "swap: page %d of obj %p in from slot %d\n",
+            pf->pf_pagenum, pf->pf_obj, se->se_slot);
+        ret = swap_bdev->bd_ops->read_block(swap_bdev, pf->pf_addr, se->se_slot, 1);
+        if (0 > ret)
+                return ret;
+
+        swap_nin++;
+        return 1;
+}
+
+/*
+ * Forgets the swapped-out copies of npages pages of 'o' starting at
+ * 'pagenum', whose contents are being thrown away.
+ */
+void
+swap_drop_range(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        swap_entry_t *se;
+        uint32_t i;
+
+        if (0 == swap_nentries)
+                return;
+        if (npages <= SWAP_HASH_SIZE) {
+                for (i = 0; i < npages; ++i) {
+                        if (NULL != (se = swap_lookup(o, pagenum + i)))
+                                swap_entry_free(se);
+                }
+                return;
+        }
+        for (i = 0; i < SWAP_HASH_SIZE; ++i) {
+                list_iterate_begin(&swap_hash[i], se, swap_entry_t, se_link) {
+                        if ((o == se->se_obj) && (se->se_pagenum - pagenum < npages))
+                                swap_entry_free(se);
+                } list_iterate_end();
+        }
+}
+
+/*
+ * Releases every swap slot and compressed copy of an object which is
+ * being freed.
+ */
+void
+swap_drop_obj(mmobj_t *o)
+{
+        swap_entry_t *se;
+        int i;
+
+        for (i = 0; (i < SWAP_HASH_SIZE) && (0 < swap_nentries); ++i) {
+                list_iterate_begin(&swap_hash[i], se, swap_entry_t, se_link) {
+                        if (o == se->se_obj)
+                                swap_entry_free(se);
+                } list_iterate_end();
+        }
+}
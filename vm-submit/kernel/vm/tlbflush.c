@@ -0,0 +1,73 @@
+#include "globals.h"
+
+#include "util/debug.h"
+
+#include "mm/page.h"
+#include "mm/tlb.h"
+
+#include "vm/tlbflush.h"
+
+tlb_stat_t tlb_stats[TLB_NCAUSES];
+const char *tlb_cause_name[TLB_NCAUSES] = {
+        "munmap", "mmap", "brk", "fork", "madvise", "mremap"
+};
+
+void
+tlb_batch_init(tlb_batch_t *tb, int cause)
+{
+        KASSERT((0 <= cause) && (cause < TLB_NCAUSES));
+        tb->tb_cause = cause;
+        tb->tb_npages = 0;
+        tb->tb_nranges = 0;
+}
+
+/*
+ * Queues npages pages starting at vaddr, which were just unmapped from
+ * the current page directory. Once the batch has grown past what is
+ * worth invalidating page by page the ranges are no longer recorded.
+ */
+void
+tlb_batch_add(tlb_batch_t *tb, uintptr_t vaddr, uint32_t npages)
+{
+        KASSERT(PAGE_ALIGNED(vaddr));
+
+        if (0 == npages)
+                return;
+        tb->tb_npages += npages;
+        if (tb->tb_npages > TLB_FLUSH_MAXPAGES)
+                return;
+
+        if ((0 < tb->tb_nranges)
+            && (tb->tb_start[tb->tb_nranges - 1]
+                + tb->tb_len[tb->tb_nranges - 1] * PAGE_SIZE == vaddr)) {
+                tb->tb_len[tb->tb_nranges - 1] += npages;
+        } else if (tb->tb_nranges < TLB_BATCH_RANGES) {
+                tb->tb_start[tb->tb_nranges] = vaddr;
+                tb->tb_len[tb->tb_nranges] = npages;
+                tb->tb_nranges++;
+        } else {
+                /* out of room, fall back to a full flush */
+                tb->tb_npages = TLB_FLUSH_MAXPAGES + 1;
+        }
+}
+
+void
+tlb_batch_finish(tlb_batch_t *tb)
+{
+        tlb_stat_t *ts = &tlb_stats[tb->tb_cause];
+        uint32_t i;
+
+        ts->ts_nbatches++;
+        if (0 == tb->tb_npages) {
+                ts->ts_nempty++;
+        } else if (tb->tb_npages > TLB_FLUSH_MAXPAGES) {
+                tlb_flush_all();
+                ts->ts_nfull++;
+        } else {
+                for (i = 0; i < tb->tb_nranges; ++i)
+                        tlb_flush_range(tb->tb_start[i], tb->tb_len[i]);
+                ts->ts_ninvlpg += tb->tb_npages;
+        }
+        tb->tb_npages = 0;
+        tb->tb_nranges = 0;
+}
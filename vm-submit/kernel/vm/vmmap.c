@@ -4,8 +4,14 @@
 #include "limits.h"
 
 #include "vm/vmmap.h"
+#include "vm/vmmapext.h"
+#include "vm/madvise.h"
 #include "vm/shadow.h"
 #include "vm/anon.h"
+#include "vm/anonmem.h"
+#include "vm/swap.h"
+#include "vm/tlbflush.h"
+#include "vm/mremap.h"
 
 #include "proc/proc.h"
 
@@ -24,34 +30,409 @@
 #include "mm/mm.h"
 #include "mm/mman.h"
 #include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
 
+/*
+ * Besides the sorted vmm_list, which is kept for in-order walks, the
+ * areas of a map are kept in an AVL tree keyed on vma_start so that
+ * vmmap_lookup, vmmap_find_range and vmmap_is_range_empty take
+ * O(log n). Areas never overlap, so each subtree also records the
+ * lowest start, the highest end and the largest gap between two of
+ * its areas; this is enough to find the first gap of a given size
+ * without visiting subtrees that cannot hold it.
+ *
+ * Faults tend to hit the same area many times in a row, so each map
+ * also remembers the area its last successful lookup returned. Any
+ * change to the map drops it.
+ *
+ * Each area also records the span of its pages which may have been
+ * entered in the page table, so that unmapping pages which were never
+ * touched skips both the page table walk and the TLB invalidation.
+ *
+ * All of this lives in the wrapper structures below, around vmarea_t
+ * and vmmap_t (see proc/procstat.h).
+ */
+typedef struct vmarea_node {
+  vmarea_t             vt_vma;
+  struct vmarea_node  *vt_left;
+  struct vmarea_node  *vt_right;
+  int                  vt_height;
+  uint32_t             vt_minstart;
+  uint32_t             vt_maxend;
+  uint32_t             vt_maxgap;
+  int                  vt_advice;  /* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL */
+  uint32_t             vt_maplo;   /* pages [vt_maplo, vt_maphi) may be mapped */
+  uint32_t             vt_maphi;
+} vmarea_node_t;
+
+typedef struct vmmap_ext {
+  vmmap_t              vx_map;
+  vmarea_node_t       *vx_root;
+  vmarea_t            *vx_last;   /* area last found by vmmap_lookup */
+  vmarea_t            *vx_heap;   /* area holding the brk heap, see brk.c */
+} vmmap_ext_t;
+
+#define vmarea_node(vma)  CONTAINER_OF((vma), vmarea_node_t, vt_vma)
+#define vmmap_ext(map)    CONTAINER_OF((map), vmmap_ext_t, vx_map)
+#define vt_height(n)      ((NULL == (n)) ? 0 : (n)->vt_height)
+
+uint32_t vmmap_lookups = 0;
+uint32_t vmmap_lookup_hits = 0;
+
+static int vmmap_remove_range(vmmap_t *map, uint32_t lopage, uint32_t npages, tlb_batch_t *tb);
+
+/* recomputes the annotations of n from its children */
+static void
+vt_update(vmarea_node_t *n)
+{
+  uint32_t gap = 0;
+
+  n->vt_height = 1 + MAX(vt_height(n->vt_left), vt_height(n->vt_right));
+  n->vt_minstart = n->vt_vma.vma_start;
+  n->vt_maxend = n->vt_vma.vma_end;
+  n->vt_maxgap = 0;
+  if(NULL != n->vt_left)
+    {
+      n->vt_minstart = n->vt_left->vt_minstart;
+      gap = n->vt_vma.vma_start - n->vt_left->vt_maxend;
+      n->vt_maxgap = MAX(n->vt_left->vt_maxgap, gap);
+    }
+  if(NULL != n->vt_right)
+    {
+      n->vt_maxend = n->vt_right->vt_maxend;
+      gap = n->vt_right->vt_minstart - n->vt_vma.vma_end;
+      n->vt_maxgap = MAX(n->vt_maxgap, MAX(n->vt_right->vt_maxgap, gap));
+    }
+}
+
+static vmarea_node_t *
+vt_rotate_right(vmarea_node_t *n)
+{
+  vmarea_node_t *l = n->vt_left;
+  n->vt_left = l->vt_right;
+  l->vt_right = n;
+  vt_update(n);
+  vt_update(l);
+  return l;
+}
+
+static vmarea_node_t *
+vt_rotate_left(vmarea_node_t *n)
+{
+  vmarea_node_t *r = n->vt_right;
+  n->vt_right = r->vt_left;
+  r->vt_left = n;
+  vt_update(n);
+  vt_update(r);
+  return r;
+}
+
+/* restores the AVL property at n, returns the new root of the subtree */
+static vmarea_node_t *
+vt_balance(vmarea_node_t *n)
+{
+  int bf;
+
+  vt_update(n);
+  bf = vt_height(n->vt_left) - vt_height(n->vt_right);
+  if(1 < bf)
+    {
+      if(vt_height(n->vt_left->vt_left) < vt_height(n->vt_left->vt_right))
+        n->vt_left = vt_rotate_left(n->vt_left);
+      return vt_rotate_right(n);
+    }
+  if(-1 > bf)
+    {
+      if(vt_height(n->vt_right->vt_right) < vt_height(n->vt_right->vt_left))
+        n->vt_right = vt_rotate_right(n->vt_right);
+      return vt_rotate_left(n);
+    }
+  return n;
+}
+
+static vmarea_node_t *
+vt_insert(vmarea_node_t *n, vmarea_node_t *newn)
+{
+  if(NULL == n)
+    {
+      newn->vt_left = NULL;
+      newn->vt_right = NULL;
+      vt_update(newn);
+      return newn;
+    }
+  if(newn->vt_vma.vma_start < n->vt_vma.vma_start)
+    n->vt_left = vt_insert(n->vt_left, newn);
+  else
+    n->vt_right = vt_insert(n->vt_right, newn);
+  return vt_balance(n);
+}
+
+static vmarea_node_t *
+vt_remove_min(vmarea_node_t *n, vmarea_node_t **minp)
+{
+  if(NULL == n->vt_left)
+    {
+      *minp = n;
+      return n->vt_right;
+    }
+  n->vt_left = vt_remove_min(n->vt_left, minp);
+  return vt_balance(n);
+}
+
+static vmarea_node_t *
+vt_remove(vmarea_node_t *n, vmarea_node_t *deln)
+{
+  vmarea_node_t *m = NULL;
+
+  KASSERT(NULL != n);
+  if(n == deln)
+    {
+      if(NULL == n->vt_left)
+        return n->vt_right;
+      if(NULL == n->vt_right)
+        return n->vt_left;
+      n->vt_right = vt_remove_min(n->vt_right, &m);
+      m->vt_left = n->vt_left;
+      m->vt_right = n->vt_right;
+      return vt_balance(m);
+    }
+  if(deln->vt_vma.vma_start < n->vt_vma.vma_start)
+    n->vt_left = vt_remove(n->vt_left, deln);
+  else
+    n->vt_right = vt_remove(n->vt_right, deln);
+  return vt_balance(n);
+}
+
+/* recomputes the annotations on the path from n down to target */
+static void
+vt_fixup(vmarea_node_t *n, vmarea_node_t *target)
+{
+  KASSERT(NULL != n);
+  if(n != target)
+    {
+      if(target->vt_vma.vma_start < n->vt_vma.vma_start)
+        vt_fixup(n->vt_left, target);
+      else
+        vt_fixup(n->vt_right, target);
+    }
+  vt_update(n);
+}
+
+/* returns the area with the highest start <= vfn, or NULL */
+static vmarea_t *
+vt_floor(vmarea_node_t *n, uint32_t vfn)
+{
+  vmarea_node_t *best = NULL;
+  while(NULL != n)
+    {
+      if(n->vt_vma.vma_start <= vfn)
+        {
+          best = n;
+          n = n->vt_right;
+        }
+      else
+        n = n->vt_left;
+    }
+  return (NULL == best) ? NULL : &best->vt_vma;
+}
+
+/* returns the area with the lowest end > vfn, or NULL */
+static vmarea_t *
+vt_first_ending_after(vmarea_node_t *n, uint32_t vfn)
+{
+  vmarea_node_t *best = NULL;
+  while(NULL != n)
+    {
+      if(n->vt_vma.vma_end > vfn)
+        {
+          best = n;
+          n = n->vt_left;
+        }
+      else
+        n = n->vt_right;
+    }
+  return (NULL == best) ? NULL : &best->vt_vma;
+}
+
+/*
+ * Lowest gap of npages in subtree n, given that the area before the
+ * subtree ends at prevend. Returns its first vfn or -1.
+ */
+static int
+vt_find_lohi(vmarea_node_t *n, uint32_t prevend, uint32_t npages)
+{
+  if(NULL == n)
+    return -1;
+  if(NULL != n->vt_left)
+    {
+      if((npages <= n->vt_left->vt_minstart - prevend) || (npages <= n->vt_left->vt_maxgap))
+        return vt_find_lohi(n->vt_left, prevend, npages);
+      prevend = n->vt_left->vt_maxend;
+    }
+  if(npages <= n->vt_vma.vma_start - prevend)
+    return prevend;
+  prevend = n->vt_vma.vma_end;
+  if((NULL != n->vt_right)
+     && ((npages <= n->vt_right->vt_minstart - prevend) || (npages <= n->vt_right->vt_maxgap)))
+    return vt_find_lohi(n->vt_right, prevend, npages);
+  return -1;
+}
+
+/*
+ * Highest gap of npages in subtree n, given that the area after the
+ * subtree starts at nextstart. Returns its first vfn or -1.
+ */
+static int
+vt_find_hilo(vmarea_node_t *n, uint32_t nextstart, uint32_t npages)
+{
+  if(NULL == n)
+    return -1;
+  if(NULL != n->vt_right)
+    {
+      if((npages <= nextstart - n->vt_right->vt_maxend) || (npages <= n->vt_right->vt_maxgap))
+        return vt_find_hilo(n->vt_right, nextstart, npages);
+      nextstart = n->vt_right->vt_minstart;
+    }
+  if(npages <= nextstart - n->vt_vma.vma_end)
+    return nextstart - npages;
+  nextstart = n->vt_vma.vma_start;
+  if((NULL != n->vt_left)
+     && ((npages <= nextstart - n->vt_left->vt_maxend) || (npages <= n->vt_left->vt_maxgap)))
+    return vt_find_hilo(n->vt_left, nextstart, npages);
+  return -1;
+}
+
+static void
+vmmap_tree_insert(vmmap_t *map, vmarea_t *vma)
+{
+  vmmap_ext(map)->vx_last = NULL;
+  vmmap_ext(map)->vx_root = vt_insert(vmmap_ext(map)->vx_root, vmarea_node(vma));
+}
+
+static void
+vmmap_tree_remove(vmmap_t *map, vmarea_t *vma)
+{
+  vmmap_ext(map)->vx_last = NULL;
+  if(vma == vmmap_ext(map)->vx_heap)
+    vmmap_ext(map)->vx_heap = NULL;
+  vmmap_ext(map)->vx_root = vt_remove(vmmap_ext(map)->vx_root, vmarea_node(vma));
+}
+
+/* Must be called after the start or end of vma was moved in place. */
+void
+vmmap_area_resized(vmmap_t *map, vmarea_t *vma)
+{
+  KASSERT(map == vma->vma_vmmap);
+  vmmap_ext(map)->vx_last = NULL;
+  vt_fixup(vmmap_ext(map)->vx_root, vmarea_node(vma));
+}
+
+/* The area do_brk grows and shrinks, or NULL if there is none yet. */
+vmarea_t *
+vmmap_heap(vmmap_t *map)
+{
+  return vmmap_ext(map)->vx_heap;
+}
+
+void
+vmmap_set_heap(vmmap_t *map, vmarea_t *vma)
+{
+  KASSERT((NULL == vma) || (map == vma->vma_vmmap));
+  vmmap_ext(map)->vx_heap = vma;
+}
+
+/* Access pattern hint given with madvise for the area. */
+int
+vmarea_advice(vmarea_t *vma)
+{
+  return vmarea_node(vma)->vt_advice;
+}
+
+void
+vmarea_set_advice(vmarea_t *vma, int advice)
+{
+  vmarea_node(vma)->vt_advice = advice;
+}
+
+/* Records that the fault handler entered pages [lopage, hipage) of vma
+ * in the page table. */
+void
+vmarea_mapped(vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+  vmarea_node_t *node = vmarea_node(vma);
+
+  if(node->vt_maplo >= node->vt_maphi)
+    {
+      node->vt_maplo = lopage;
+      node->vt_maphi = hipage;
+      return;
+    }
+  node->vt_maplo = MIN(node->vt_maplo, lopage);
+  node->vt_maphi = MAX(node->vt_maphi, hipage);
+}
+
+/*
+ * Removes pages [lopage, hipage) of vma from the current page table
+ * and queues them in tb for invalidation (tb may be NULL if the page
+ * directory is going away anyway). Only the part the area may have
+ * mapped is touched.
+ */
+void
+vmarea_unmap(vmarea_t *vma, uint32_t lopage, uint32_t hipage, tlb_batch_t *tb)
+{
+  vmarea_node_t *node = vmarea_node(vma);
+
+  lopage = MAX(lopage, node->vt_maplo);
+  hipage = MIN(hipage, node->vt_maphi);
+  if(lopage >= hipage)
+    return;
+
+  pt_unmap_range(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(lopage), (uintptr_t)PN_TO_ADDR(hipage));
+  if(NULL != tb)
+    tlb_batch_add(tb, (uintptr_t)PN_TO_ADDR(lopage), hipage - lopage);
+
+  if(lopage == node->vt_maplo)
+    node->vt_maplo = hipage;
+  else if(hipage == node->vt_maphi)
+    node->vt_maphi = lopage;
+  if(node->vt_maplo >= node->vt_maphi)
+    node->vt_maplo = node->vt_maphi = 0;
+}
+
 void
 vmmap_init(void)
 {
-  vmmap_allocator = slab_allocator_create("vmmap", sizeof(vmmap_t));
+  vmmap_allocator = slab_allocator_create("vmmap", sizeof(vmmap_ext_t));
   KASSERT(NULL != vmmap_allocator && "failed to create vmmap allocator!");
-  vmarea_allocator = slab_allocator_create("vmarea", sizeof(vmarea_t));
+  vmarea_allocator = slab_allocator_create("vmarea", sizeof(vmarea_node_t));
   KASSERT(NULL != vmarea_allocator && "failed to create vmarea allocator!");
 }
 
 vmarea_t *
 vmarea_alloc(void)
 {       /* didn't initialize links of list*/
-  vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
-  if (newvma) {
-    newvma->vma_vmmap = NULL;
-  }
-  return newvma;
+  vmarea_node_t *newnode = (vmarea_node_t *) slab_obj_alloc(vmarea_allocator);
+  if (NULL == newnode)
+    return NULL;
+  newnode->vt_left = NULL;
+  newnode->vt_right = NULL;
+  newnode->vt_advice = MADV_NORMAL;
+  newnode->vt_maplo = 0;
+  newnode->vt_maphi = 0;
+  newnode->vt_vma.vma_vmmap = NULL;
+  return &newnode->vt_vma;
 }
 
 void
 vmarea_free(vmarea_t *vma)
 {
   KASSERT(NULL != vma);
-  slab_obj_free(vmarea_allocator, vma);
+  slab_obj_free(vmarea_allocator, vmarea_node(vma));
 }
 
 /* Create a new vmmap, which has no vmareas and does
@@ -60,8 +441,12 @@ vmmap_t *
 vmmap_create(void)
 {
 
-  vmmap_t* newObj = (vmmap_t *)slab_obj_alloc(vmmap_allocator); /*pankaj*/
-  KASSERT(newObj && "could not allocate memory");
+  vmmap_ext_t* newExt = (vmmap_ext_t *)slab_obj_alloc(vmmap_allocator); /*pankaj*/
+  KASSERT(newExt && "could not allocate memory");
+  vmmap_t* newObj = &newExt->vx_map;
+  newExt->vx_root = NULL;
+  newExt->vx_last = NULL;
+  newExt->vx_heap = NULL;
   newObj->vmm_proc = NULL;
   list_init(&(newObj->vmm_list));
   return newObj;
@@ -80,11 +465,13 @@ vmmap_destroy(vmmap_t *map)
   vmarea_t* iterator =NULL;
   list_iterate_begin( &map->vmm_list, iterator, vmarea_t, vma_plink)
     {
-      vmmap_remove(map,iterator->vma_start,iterator->vma_end - iterator->vma_start);
+      vmmap_remove_range(map,iterator->vma_start,iterator->vma_end - iterator->vma_start, NULL);
 			  
     }list_iterate_end();
 		
-  slab_obj_free(vmmap_allocator, map);
+  KASSERT(NULL == vmmap_ext(map)->vx_root);
+  vmmap_ext(map)->vx_last = NULL;
+  slab_obj_free(vmmap_allocator, vmmap_ext(map));
 }
 
 /* Add a vmarea to an address space. Assumes (i.e. asserts to some extent)
@@ -117,19 +504,15 @@ vmmap_insert(vmmap_t *map, vmarea_t *newvma)
 
   if(!vmmap_is_range_empty(map, newvma->vma_start, newvma->vma_end - newvma->vma_start))
     return ;
-  
-   list_iterate_begin(&map->vmm_list, iterator, vmarea_t,vma_plink )
-    {
-	  if(!( iterator->vma_start < newvma->vma_end))
-      	{
-	  list_insert_before(&iterator->vma_plink, &newvma->vma_plink);
-	  newvma->vma_vmmap = map;
-	  return;
-      	}
-    }list_iterate_end();
 
-  list_insert_tail(&map->vmm_list,&newvma->vma_plink);
-  newvma->vma_vmmap = map;        
+  /* the list position is right after the area preceding the new one */
+  iterator = vt_floor(vmmap_ext(map)->vx_root, newvma->vma_start);
+  if(NULL == iterator)
+    list_insert_head(&map->vmm_list, &newvma->vma_plink);
+  else
+    list_insert_before(iterator->vma_plink.l_next, &newvma->vma_plink);
+  newvma->vma_vmmap = map;
+  vmmap_tree_insert(map, newvma);
 }
 
 /* Find a contiguous range of free virtual pages of length npages in
@@ -150,73 +533,41 @@ vmmap_find_range(vmmap_t *map, uint32_t npages, int dir)
 
 	KASSERT(0 < npages);
 	dbg(DBG_ALL, "GRADING3 1.c: uint32_t npages are greater than zero\n");
-	vmarea_t* iterator=NULL;
-	uint32_t memLowAddr;
-	uint32_t memHighAddr ;
-	vmarea_t* vmaareaTemp=NULL;
+	vmarea_node_t* root = vmmap_ext(map)->vx_root;
+	uint32_t memLowAddr = ADDR_TO_PN(USER_MEM_LOW);
+	uint32_t memHighAddr = ADDR_TO_PN(USER_MEM_HIGH);
+	int retVal = -1;
+
+	/* the tree search covers the gaps before and between areas, the
+	 * gap at the far end of the address space is checked here */
 	if(VMMAP_DIR_LOHI != dir)
 	{
-		vmaareaTemp = NULL;
-		memHighAddr = ADDR_TO_PN(USER_MEM_HIGH);
-		list_iterate_reverse(&map->vmm_list, vmaareaTemp, vmarea_t, vma_plink)
-		{
-			if(npages > (memHighAddr - vmaareaTemp->vma_end)  )
-			{
-				memHighAddr = vmaareaTemp->vma_start;
-			}
-			else
-			{
-
-				return memHighAddr - npages;
-			}
-
-		}list_iterate_end();
-		if(   ADDR_TO_PN(USER_MEM_LOW) > (memHighAddr- npages ) )
+		retVal = vt_find_hilo(root, memHighAddr, npages);
+		if(0 <= retVal)
+			return retVal;
+		if(NULL != root)
+			memHighAddr = root->vt_minstart;
+		if(npages > memHighAddr - memLowAddr)
 			return -1;
-		else
-
-			return memHighAddr - npages;
-
+		return memHighAddr - npages;
 	}
 	else
 	{
-
-
-
-
-		memLowAddr = ADDR_TO_PN(USER_MEM_LOW);
-
-		list_iterate_begin(&map->vmm_list, iterator, vmarea_t, vma_plink)
-		{
-			if( npages > (iterator->vma_start - memLowAddr))
-			{
-				memLowAddr = iterator->vma_end;
-			}
-			else
-			{
-
-				return memLowAddr;
-
-			}
-
-		}list_iterate_end();
-
-		if(ADDR_TO_PN(USER_MEM_HIGH) < (npages + memLowAddr ))
-		{
+		retVal = vt_find_lohi(root, memLowAddr, npages);
+		if(0 <= retVal)
+			return retVal;
+		if(NULL != root)
+			memLowAddr = root->vt_maxend;
+		if(npages > memHighAddr - memLowAddr)
 			return -1;
-		}
-		else
-
-		{
-			return memLowAddr;
-		}
+		return memLowAddr;
 	}
-
 }
 
-/* Find the vm_area that vfn lies in. Simply scan the address space
- * looking for a vma whose range covers vfn. If the page is unmapped,
- * return NULL. */
+/* Find the vm_area that vfn lies in: the area found last time if it
+ * still covers vfn, else the area with the highest start not above
+ * vfn, if it also ends above vfn. If the page is unmapped, return
+ * NULL. */
 vmarea_t *
 vmmap_lookup(vmmap_t *map, uint32_t vfn)
 {
@@ -225,12 +576,20 @@ vmmap_lookup(vmmap_t *map, uint32_t vfn)
   KASSERT(NULL != map);
   dbg(DBG_ALL, "GRADING3 1.d: vmmap_t map is not NULL \n");
 
-  vmarea_t* iterator = NULL;
-  list_iterate_begin(&map->vmm_list, iterator, vmarea_t,vma_plink )
+  vmarea_t* iterator = vmmap_ext(map)->vx_last;
+  vmmap_lookups++;
+  if((NULL != iterator) && (iterator->vma_start <= vfn) && (iterator->vma_end > vfn))
     {
-      if(( iterator->vma_start <= vfn)  &&  ( iterator->vma_end  > vfn ) )
-	return iterator;
-    }list_iterate_end();
+      vmmap_lookup_hits++;
+      return iterator;
+    }
+
+  iterator = vt_floor(vmmap_ext(map)->vx_root, vfn);
+  if((NULL != iterator) && (iterator->vma_end > vfn))
+    {
+      vmmap_ext(map)->vx_last = iterator;
+      return iterator;
+    }
   
   return NULL;
 }
@@ -262,11 +621,15 @@ vmmap_clone(vmmap_t *map)
       vma->vma_off = iterator->vma_off;
 
       vma->vma_flags = iterator->vma_flags;
+      vmarea_set_advice(vma, vmarea_advice(iterator));
       list_link_init(&vma->vma_olink);
       list_link_init(&vma->vma_plink);
 
       list_insert_tail(&newMapObj->vmm_list, &vma->vma_plink);
       vma->vma_vmmap = newMapObj;
+      vmmap_tree_insert(newMapObj, vma);
+      if(iterator == vmmap_heap(map))
+        vmmap_set_heap(newMapObj, vma);
     }list_iterate_end();
 				
   return newMapObj;
@@ -337,7 +700,7 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
 	  if(!vmmap_is_range_empty(map, lopage, npages))
 	 	{
 
-	 	  vmmap_remove( map, lopage, npages);
+	 	  vmmap_remove_cause( map, lopage, npages, TLB_MMAP);
 	 	  KASSERT(vmmap_is_range_empty(map,lopage,npages));
 	 	}
 	       vmareaObj->vma_start = lopage;
@@ -415,6 +778,274 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
   return 0;
 }
 
+/*
+ * Returns 1 if vma is private anonymous memory with protections prot
+ * whose objects (a single shadow object over an anonymous object)
+ * belong to it alone, so that its range can be grown. The brk heap is
+ * never grown this way.
+ */
+static int
+vmmap_anon_extendable(vmarea_t *vma, int prot, int flags)
+{
+  mmobj_t* top = vma->vma_obj;
+  mmobj_t* bottom = NULL;
+
+  if((prot != vma->vma_prot) || (MADV_NORMAL != vmarea_advice(vma)))
+    return 0;
+  /* the end of the heap belongs to brk, which may keep a reserve there;
+   * that includes the data area the initial break falls into */
+  if(vma == vmmap_heap(vma->vma_vmmap))
+    return 0;
+  if((NULL != vma->vma_vmmap->vmm_proc)
+     && (ADDR_TO_PN(vma->vma_vmmap->vmm_proc->p_start_brk) - vma->vma_start
+         < vma->vma_end - vma->vma_start))
+    return 0;
+  if(!(MAP_PRIVATE & flags) || !(MAP_PRIVATE & vma->vma_flags))
+    return 0;
+  if((NULL == top) || (NULL == (bottom = top->mmo_shadowed)))
+    return 0;
+  if((NULL != bottom->mmo_shadowed) || !mmobj_is_anon(bottom))
+    return 0;
+
+  /* resident pages hold references of their own */
+  if((1 != top->mmo_refcount - top->mmo_nrespages)
+     || (1 != bottom->mmo_refcount - bottom->mmo_nrespages))
+    return 0;
+  return 1;
+}
+
+/*
+ * Returns 1 if no page in [pagenum, pagenum + npages) of 'o' is
+ * resident or swapped out, e.g. left over from a part of the area
+ * which was unmapped earlier.
+ */
+static int
+vmmap_obj_range_unused(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+  pframe_t* pf = NULL;
+  list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink){
+    if(pf->pf_pagenum - pagenum < npages)
+      return 0;
+  }list_iterate_end();
+  return !swap_has_range(o, pagenum, npages);
+}
+
+/*
+ * Maps the empty range [lopage, lopage + npages) as private anonymous
+ * memory by growing an adjacent area with the same protections over
+ * it instead of creating a new area with new objects. Returns the grown
+ * area, or NULL if neither neighbour can be grown (the caller then uses
+ * vmmap_map).
+ */
+vmarea_t *
+vmmap_extend_anon(vmmap_t *map, uint32_t lopage, uint32_t npages, int prot, int flags)
+{
+  vmarea_t* vma = NULL;
+  uint32_t pagenum = 0;
+
+  KASSERT(vmmap_is_range_empty(map, lopage, npages));
+
+  /* grow the area below upwards */
+  if(ADDR_TO_PN(USER_MEM_LOW) < lopage)
+    vma = vmmap_lookup(map, lopage - 1);
+  if((NULL != vma) && vmmap_anon_extendable(vma, prot, flags))
+    {
+      pagenum = vma->vma_off + vma->vma_end - vma->vma_start;
+      if(vmmap_obj_range_unused(vma->vma_obj, pagenum, npages)
+         && vmmap_obj_range_unused(vma->vma_obj->mmo_shadowed, pagenum, npages))
+        {
+          vma->vma_end += npages;
+          vmmap_area_resized(map, vma);
+          return vma;
+        }
+    }
+
+  /* grow the area above downwards, if its object has room below */
+  vma = NULL;
+  if(ADDR_TO_PN(USER_MEM_HIGH) > lopage + npages)
+    vma = vmmap_lookup(map, lopage + npages);
+  if((NULL != vma) && (npages <= vma->vma_off) && vmmap_anon_extendable(vma, prot, flags))
+    {
+      pagenum = vma->vma_off - npages;
+      if(vmmap_obj_range_unused(vma->vma_obj, pagenum, npages)
+         && vmmap_obj_range_unused(vma->vma_obj->mmo_shadowed, pagenum, npages))
+        {
+          vma->vma_start = lopage;
+          vma->vma_off = pagenum;
+          vmmap_area_resized(map, vma);
+          return vma;
+        }
+    }
+  return NULL;
+}
+
+/*
+ * Splits vma in two at page vfn, which must lie strictly inside it.
+ * Both halves share the object; the page table is not touched.
+ * Returns the upper half, or NULL if there is no memory for it.
+ */
+static vmarea_t *
+vmmap_split(vmmap_t *map, vmarea_t *vma, uint32_t vfn)
+{
+  vmarea_t* upper = vmarea_alloc();
+
+  KASSERT((vma->vma_start < vfn) && (vfn < vma->vma_end));
+  if(NULL == upper)
+    return NULL;
+
+  list_link_init(&upper->vma_plink);
+  list_link_init(&upper->vma_olink);
+  upper->vma_start = vfn;
+  upper->vma_end = vma->vma_end;
+  upper->vma_off = vma->vma_off + vfn - vma->vma_start;
+  upper->vma_prot = vma->vma_prot;
+  upper->vma_flags = vma->vma_flags;
+  upper->vma_obj = vma->vma_obj;
+  upper->vma_obj->mmo_ops->ref(upper->vma_obj);
+  vmarea_set_advice(upper, vmarea_advice(vma));
+  vmarea_node(upper)->vt_maplo = vmarea_node(vma)->vt_maplo;
+  vmarea_node(upper)->vt_maphi = vmarea_node(vma)->vt_maphi;
+
+  vma->vma_end = vfn;
+  vmmap_area_resized(map, vma);
+  vmmap_insert(map, upper);
+  list_insert_tail(mmobj_bottom_vmas(upper->vma_obj), &upper->vma_olink);
+  return upper;
+}
+
+/*
+ * Makes [lopage, hipage), which must lie within a single area, an area
+ * of its own by splitting that area as needed. Returns it, or NULL if
+ * the range is not inside one area or memory ran out.
+ */
+vmarea_t *
+vmmap_isolate(vmmap_t *map, uint32_t lopage, uint32_t hipage)
+{
+  vmarea_t* vma = vmmap_lookup(map, lopage);
+
+  if((NULL == vma) || (hipage > vma->vma_end))
+    return NULL;
+  if((hipage < vma->vma_end) && (NULL == vmmap_split(map, vma, hipage)))
+    return NULL;
+  if(lopage > vma->vma_start)
+    vma = vmmap_split(map, vma, lopage);
+  return vma;
+}
+
+/*
+ * Moves vma to [newlo, newlo + npages), a free range at least as large
+ * as the area, keeping its object and offset. Pages which were mapped
+ * at the old address and are still resident are mapped at the new one
+ * right away, so nothing is copied or faulted in again.
+ */
+void
+vmmap_move(vmmap_t *map, vmarea_t *vma, uint32_t newlo, uint32_t npages)
+{
+  vmarea_node_t* node = vmarea_node(vma);
+  uint32_t oldlo = vma->vma_start;
+  uint32_t lo = MAX(node->vt_maplo, vma->vma_start);
+  uint32_t hi = MIN(node->vt_maphi, vma->vma_end);
+  uint32_t vfn = 0;
+  tlb_batch_t tb;
+
+  KASSERT(npages >= vma->vma_end - vma->vma_start);
+  KASSERT(vmmap_is_range_empty(map, newlo, npages));
+
+  tlb_batch_init(&tb, TLB_MREMAP);
+  vmarea_unmap(vma, vma->vma_start, vma->vma_end, &tb);
+  tlb_batch_finish(&tb);
+
+  vmmap_tree_remove(map, vma);
+  list_remove(&vma->vma_plink);
+  vma->vma_vmmap = NULL;
+  vma->vma_start = newlo;
+  vma->vma_end = newlo + npages;
+  vmmap_insert(map, vma);
+
+  for(vfn = lo; vfn < hi; vfn++)
+    pagefault_map_resident(vma, newlo + vfn - oldlo);
+}
+
+/*
+ * Returns 1 if vma can grow by npages at its end without showing data
+ * which is not its own: no anonymous or shadow object under it may hold
+ * a page in the object range it would grow into (left over from a part
+ * unmapped or shrunk earlier), and no other area on the same object may
+ * map that range (as the other half of a split area does). File pages
+ * are anybody's to map.
+ */
+int
+vmmap_area_growable(vmarea_t *vma, uint32_t npages)
+{
+  uint32_t pagenum = vma->vma_off + vma->vma_end - vma->vma_start;
+  vmarea_t* other = NULL;
+  mmobj_t* o = NULL;
+
+  for(o = vma->vma_obj; (NULL != o) && ((NULL != o->mmo_shadowed) || mmobj_is_anon(o));
+      o = o->mmo_shadowed)
+    {
+      if(!vmmap_obj_range_unused(o, pagenum, npages))
+        return 0;
+    }
+  if((NULL == vma->vma_obj->mmo_shadowed) && !mmobj_is_anon(vma->vma_obj))
+    return 1;
+
+  list_iterate_begin(mmobj_bottom_vmas(vma->vma_obj), other, vmarea_t, vma_olink){
+    if((other != vma) && (other->vma_obj == vma->vma_obj)
+       && (other->vma_off < pagenum + npages)
+       && (pagenum < other->vma_off + other->vma_end - other->vma_start))
+      return 0;
+  }list_iterate_end();
+  return 1;
+}
+
+/*
+ * Maps [lopage, lopage + npages), a free range, with vma's protections
+ * and flags over what vma would map if it went on past its end, but
+ * with objects of its own: fresh anonymous memory if vma is anonymous,
+ * otherwise a new shadow object over the file pages that follow vma's.
+ * For mremap, when vma cannot grow itself. Returns 0 or -ENOMEM.
+ */
+int
+vmmap_map_past(vmmap_t *map, vmarea_t *vma, uint32_t lopage, uint32_t npages)
+{
+  mmobj_t* bottom = vma->vma_obj;
+  vmarea_t* tail = NULL;
+
+  if(NULL != bottom->mmo_shadowed)
+    bottom = bottom->mmo_un.mmo_bottom_obj;
+
+  KASSERT(vmmap_is_range_empty(map, lopage, npages));
+  if(mmobj_is_anon(bottom))
+    return vmmap_map(map, NULL, lopage, npages, vma->vma_prot, vma->vma_flags,
+                     0, VMMAP_DIR_LOHI, NULL);
+
+  /* a shared file mapping can always grow; see vmmap_area_growable */
+  KASSERT(MAP_PRIVATE & vma->vma_flags);
+  if(NULL == (tail = vmarea_alloc()))
+    return -ENOMEM;
+  list_link_init(&tail->vma_plink);
+  list_link_init(&tail->vma_olink);
+  tail->vma_start = lopage;
+  tail->vma_end = lopage + npages;
+  tail->vma_off = vma->vma_off + vma->vma_end - vma->vma_start;
+  tail->vma_prot = vma->vma_prot;
+  tail->vma_flags = vma->vma_flags;
+  if(NULL == (tail->vma_obj = shadow_create()))
+    {
+      vmarea_free(tail);
+      return -ENOMEM;
+    }
+  tail->vma_obj->mmo_shadowed = bottom;
+  tail->vma_obj->mmo_un.mmo_bottom_obj = bottom;
+  bottom->mmo_ops->ref(bottom);
+  vmarea_set_advice(tail, vmarea_advice(vma));
+
+  vmmap_insert(map, tail);
+  list_insert_tail(mmobj_bottom_vmas(tail->vma_obj), &tail->vma_olink);
+  return 0;
+}
+
 /*
  * We have no guarantee that the region of the address space being
  * unmapped will play nicely with our list of vmareas.
@@ -444,8 +1075,8 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
  * The region completely contains the vmarea. Remove the vmarea from the
  * list.
  */
-int
-vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
+static int
+vmmap_remove_range(vmmap_t *map, uint32_t lopage, uint32_t npages, tlb_batch_t *tb)
 {
 
 
@@ -453,13 +1084,26 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 	uint32_t bCount = 0;
 	vmarea_t* vmareaObj = NULL;
 	uint32_t finishAddr = 0;
+	list_link_t* link = NULL;
+	list_link_t* nextLink = NULL;
 	finishAddr = lopage + npages;
 
-	list_iterate_begin(&map->vmm_list, vmareaObj, vmarea_t, vma_plink)
+	/* only the areas from the first one ending above lopage on can be affected */
+	vmareaObj = vt_first_ending_after(vmmap_ext(map)->vx_root, lopage);
+	if(NULL == vmareaObj)
+		return 0;
+
+	for(link = &vmareaObj->vma_plink; link != &map->vmm_list; link = nextLink)
 	{
+		nextLink = link->l_next;
+		vmareaObj = list_item(link, vmarea_t, vma_plink);
+		if(vmareaObj->vma_start >= finishAddr)
+			break;
+
 		if((finishAddr < vmareaObj->vma_end) && (lopage > vmareaObj->vma_start))
 		{
 
+			vmarea_unmap(vmareaObj, lopage, finishAddr, tb);
 			vmarea_t* vmareaNew = vmarea_alloc();
 
 			list_link_init(&vmareaNew->vma_plink);
@@ -468,6 +1112,9 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 			vmareaNew->vma_obj = vmareaObj->vma_obj;
 			vmareaNew->vma_flags = vmareaObj->vma_flags;
 			vmareaNew->vma_prot = vmareaObj->vma_prot;
+			vmarea_set_advice(vmareaNew, vmarea_advice(vmareaObj));
+			vmarea_node(vmareaNew)->vt_maplo = vmarea_node(vmareaObj)->vt_maplo;
+			vmarea_node(vmareaNew)->vt_maphi = vmarea_node(vmareaObj)->vt_maphi;
 
 
 
@@ -479,6 +1126,7 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 			vmareaNew->vma_start = finishAddr;
 			vmareaObj->vma_end = lopage;
 			vmareaNew->vma_off = vmareaObj->vma_off + finishAddr - vmareaObj->vma_start;
+			vmmap_area_resized(map, vmareaObj);
 
 			vmmap_insert(map,vmareaNew);
 
@@ -490,24 +1138,25 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 			}
 
 			bCount =finishAddr + bCount   -lopage;
-			pt_unmap_range(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(lopage), (uintptr_t)PN_TO_ADDR(finishAddr));
 			return bCount;
 		}
 		else if((lopage < vmareaObj->vma_end  ) && lopage > (vmareaObj->vma_start) )
 		{
 
-			pt_unmap_range(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(lopage), (uintptr_t)PN_TO_ADDR(vmareaObj->vma_end));
-			vmareaObj->vma_end = lopage;
+			vmarea_unmap(vmareaObj, lopage, vmareaObj->vma_end, tb);
 			bCount =  bCount - lopage + vmareaObj->vma_end;
+			vmareaObj->vma_end = lopage;
+			vmmap_area_resized(map, vmareaObj);
 
 		}
 		else if((finishAddr < vmareaObj->vma_end  ) && (finishAddr > (vmareaObj->vma_start)))
 		{
 
-			pt_unmap_range(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(vmareaObj->vma_start), (uintptr_t)PN_TO_ADDR(finishAddr));
+			vmarea_unmap(vmareaObj, vmareaObj->vma_start, finishAddr, tb);
+			bCount = 0 - vmareaObj->vma_start + finishAddr + bCount  ;
 			vmareaObj->vma_off = vmareaObj->vma_off + finishAddr-vmareaObj->vma_start;
 			vmareaObj->vma_start = finishAddr;
-			bCount = 0 - vmareaObj->vma_start + finishAddr + bCount  ;
+			vmmap_area_resized(map, vmareaObj);
 
 			return bCount;
 		}
@@ -519,20 +1168,42 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 			{
 				vmareaObj->vma_obj->mmo_ops->put(vmareaObj->vma_obj);
 			}
+			vmmap_tree_remove(map, vmareaObj);
 			list_remove(&vmareaObj->vma_plink);
-			pt_unmap_range(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(vmareaObj->vma_start), (uintptr_t)PN_TO_ADDR(vmareaObj->vma_end));
-			vmarea_free(vmareaObj);
+			vmarea_unmap(vmareaObj, vmareaObj->vma_start, vmareaObj->vma_end, tb);
 			bCount = bCount - vmareaObj->vma_start + vmareaObj->vma_end ;
+			vmarea_free(vmareaObj);
 		}
-		else
-			continue;
 
-	}list_iterate_end();
+	}
 
 
 	return bCount;
 }
 
+/*
+ * vmmap_remove on behalf of munmap(2): the pages unmapped are
+ * invalidated in the TLB before returning.
+ */
+int
+vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
+{
+	return vmmap_remove_cause(map, lopage, npages, TLB_MUNMAP);
+}
+
+/* Same as vmmap_remove, counting the TLB flush against cause. */
+int
+vmmap_remove_cause(vmmap_t *map, uint32_t lopage, uint32_t npages, int cause)
+{
+	tlb_batch_t tb;
+	int ret;
+
+	tlb_batch_init(&tb, cause);
+	ret = vmmap_remove_range(map, lopage, npages, &tb);
+	tlb_batch_finish(&tb);
+	return ret;
+}
+
 /*
  * Returns 1 if the given address space has no mappings for the
  * given range, 0 otherwise.
@@ -541,42 +1212,18 @@ int
 vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages)
 {
  
-	uint32_t vfnMemLow = ADDR_TO_PN(USER_MEM_LOW);
-
   uint32_t endvfn = startvfn + npages;
 
 
   KASSERT((startvfn < endvfn) && (ADDR_TO_PN(USER_MEM_LOW) <= startvfn) && (ADDR_TO_PN(USER_MEM_HIGH) >= endvfn));
   dbg(DBG_ALL, "GRADING3 1.e: startvfn is less than endvfn and USER_MEM_LOW is greater than startvfn and end vfn is less than USER_MEM_HIGH \n");
 
-  vmarea_t* iterator = NULL;
-  list_iterate_begin(&map->vmm_list, iterator, vmarea_t, vma_plink)
-    {
-      if((iterator->vma_start >= endvfn)  && (  vfnMemLow <= startvfn) )
-	{
-	  return 1;
-	}
-      else if( (iterator->vma_start > startvfn) && ( iterator->vma_start < endvfn) )
-      	{
-    	  return 0;
-      	}
-      else if(vfnMemLow > startvfn)
-	{
-    	  return 0;
-	}
-
-			  
-      vfnMemLow = iterator->vma_end;
-			  
-    }list_iterate_end();
+  /* the only area which could overlap is the last one starting below endvfn */
+  vmarea_t* iterator = vt_floor(vmmap_ext(map)->vx_root, endvfn - 1);
+  if((NULL != iterator) && (iterator->vma_end > startvfn))
+    return 0;
 
-  if( (ADDR_TO_PN(USER_MEM_HIGH) >= endvfn) && (vfnMemLow <= startvfn)  )
-    {
-	  return 1;
-    }
-			
-
-  return 0;
+  return 1;
 }
 
 /* Read into 'buf' from the virtual address space of 'map' starting at
@@ -661,6 +1308,23 @@ vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count)
 
 }
 
+/*
+ * Drops the user mapping of page vfn of map, which may still point at
+ * the shared zero page or at a copy-on-write page of an object further
+ * down, after vmmap_write put data in a frame of the area's own object.
+ * The next access faults the frame in.
+ */
+static void
+vmmap_write_unmap(vmmap_t *map, uint32_t vfn)
+{
+  if(NULL == map->vmm_proc)
+    return;
+  pt_unmap(map->vmm_proc->p_pagedir, (uintptr_t)PN_TO_ADDR(vfn));
+  /* other address spaces' entries go when their page directory is loaded */
+  if(curproc == map->vmm_proc)
+    tlb_flush((uintptr_t)PN_TO_ADDR(vfn));
+}
+
 /* Write from 'buf' into the virtual address space of 'map' starting at
  * 'vaddr' for size 'count'. To do this, you will need to find the correct
  * vmareas to write into, then find the correct pframes within those vmareas,
@@ -668,6 +1332,10 @@ vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count)
  * to. You should not check permissions of the areas you use. Assume (KASSERT)
  * that all the areas you are accessing exist. Remember to dirty pages!
  * Returns 0 on success, -errno on error.
+ *
+ * A private page which was not resident or not yet dirty in the area's
+ * own object may be mapped to something else (see vmmap_write_unmap),
+ * so its mapping is dropped once the data is in.
  */
 int
 vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
@@ -682,6 +1350,8 @@ vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
 				uint32_t finalAddr = 0 ;
 				uint32_t counter=0;
 	vmarea_t* iterator = NULL;
+	int fresh = 0;
+	int retVal = 0;
 	list_iterate_begin(&map->vmm_list, iterator, vmarea_t, vma_plink)
 	{
 		if(iterator->vma_end <= vfnInitial)
@@ -725,7 +1395,11 @@ vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
 			for(counter= initialAddr; counter < finalAddr;counter++)
 			{
 
-				pframe_get(iterator->vma_obj, (iterator->vma_off - iterator->vma_start + counter ) , &tempPgFrame);
+				tempPgFrame = pframe_get_resident(iterator->vma_obj, iterator->vma_off - iterator->vma_start + counter);
+				fresh = (NULL == tempPgFrame) || !pframe_is_dirty(tempPgFrame);
+				retVal = pframe_get(iterator->vma_obj, (iterator->vma_off - iterator->vma_start + counter ) , &tempPgFrame);
+				if(0 > retVal)
+					return retVal;
 
 				pgOfset= ((uint32_t)tempVaddr)%PAGE_SIZE;
 				tempVaddr = PN_TO_ADDR(1 + counter);
@@ -737,6 +1411,8 @@ vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
 				memcpy( (void*)((uint32_t)(tempPgFrame->pf_addr)+pgOfset),buf, MIN(0-temp + count, (0 -pgOfset + PAGE_SIZE)));
 				pframe_clear_busy(tempPgFrame);
 				sched_broadcast_on(&tempPgFrame->pf_waitq);
+				if(fresh && (MAP_PRIVATE & iterator->vma_flags))
+					vmmap_write_unmap(map, counter);
 				temp = temp +  MIN(0 -temp + count, 0 -pgOfset + PAGE_SIZE);
 			}
 
@@ -756,6 +1432,7 @@ vmmap_mapping_info(const void *vmmap, char *buf, size_t osize)
   vmmap_t *map = (vmmap_t *)vmmap;
   vmarea_t *vma;
   ssize_t size = (ssize_t)osize;
+  int nareas = 0;
 
   int len = snprintf(buf, size, "%21s %5s %7s %8s %10s %12s\n",
 		     "VADDR RANGE", "PROT", "FLAGS", "MMOBJ", "OFFSET",
@@ -789,8 +1466,18 @@ vmmap_mapping_info(const void *vmmap, char *buf, size_t osize)
       (vma->vma_prot & PROT_EXEC ? 'x' : '-'),
       (vma->vma_flags & MAP_SHARED ? " SHARED" : "PRIVATE"),
       vma->vma_obj, vma->vma_off, vma->vma_start, vma->vma_end);*/
+    nareas++;
   } list_iterate_end();
 
+  size -= len;
+  buf += len;
+  if (0 >= size) {
+    goto end;
+  }
+  len = snprintf(buf, size, "%d vmareas\n", nareas);
+  size -= len;
+  buf += len;
+
  end:
   if (size <= 0) {
     size = osize;
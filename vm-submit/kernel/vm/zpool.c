@@ -0,0 +1,230 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/string.h"
+#include "util/debug.h"
+
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "vm/zpool.h"
+
+/*
+ * Compressed page pool.
+ *
+ * Pages are compressed with LZSS: a control byte announces the kind of
+ * the next eight items, each of which is either a literal byte or a
+ * two byte back reference holding a 12 bit offset and a 4 bit length
+ * (3 to 18 bytes). Back references are found through a hash table of
+ * the last position each 3 byte sequence was seen at. The table is not
+ * cleared between pages: a candidate is only used after its bytes have
+ * been compared, so stale entries just cost a miss.
+ *
+ * Compressed pages live in one of a few size-class slab allocators.
+ */
+
+#define ZPOOL_MIN_MATCH   3
+#define ZPOOL_MAX_MATCH   (ZPOOL_MIN_MATCH + 15)
+#define ZPOOL_MAX_OFFSET  4095
+#define ZPOOL_HASH_BITS   12
+
+#define hash_zpool(p)  ((((p)[0] << 8) ^ ((p)[1] << 4) ^ (p)[2]) \
+                        & ((1 << ZPOOL_HASH_BITS) - 1))
+
+static uint16_t zpool_htab[1 << ZPOOL_HASH_BITS];
+
+/* compression scratch space, one page is enough to know it did not fit */
+static uint8_t zpool_buf[PAGE_SIZE];
+
+static const uint32_t zpool_class_size[] = {
+        128, 256, 512, 768, 1024, 1536, 2048, ZPOOL_MAX_OBJSIZE
+};
+static const char *zpool_class_name[] = {
+        "zpool 128", "zpool 256", "zpool 512", "zpool 768",
+        "zpool 1024", "zpool 1536", "zpool 2048", "zpool 3072"
+};
+#define ZPOOL_NCLASSES (sizeof(zpool_class_size) / sizeof(zpool_class_size[0]))
+
+static slab_allocator_t *zpool_allocator[ZPOOL_NCLASSES];
+
+uint32_t zpool_nstored = 0;
+uint32_t zpool_comp_bytes = 0;
+uint32_t zpool_alloc_bytes = 0;
+uint32_t zpool_nrejected = 0;
+uint32_t zpool_nhits = 0;
+uint32_t zpool_hit_cycles = 0;
+
+void
+zpool_init(void)
+{
+        uint32_t i;
+        for (i = 0; i < ZPOOL_NCLASSES; ++i) {
+                zpool_allocator[i] = slab_allocator_create(zpool_class_name[i],
+                                                           zpool_class_size[i]);
+                KASSERT(NULL != zpool_allocator[i]);
+        }
+}
+init_func(zpool_init);
+
+int
+zpool_enabled(void)
+{
+#ifdef __ZRAM__
+        return 1;
+#else
+        return 0;
+#endif
+}
+
+static int
+zpool_class(uint32_t len)
+{
+        uint32_t i;
+        for (i = 0; i < ZPOOL_NCLASSES; ++i) {
+                if (len <= zpool_class_size[i])
+                        return i;
+        }
+        return -1;
+}
+
+/*
+ * Compresses one page from src into dst. Returns the compressed length,
+ * or 0 if it would take more than dstmax bytes.
+ */
+static uint32_t
+zpool_compress(const uint8_t *src, uint8_t *dst, uint32_t dstmax)
+{
+        uint32_t ip = 0, op = 0, ctrl = 0;
+        int bit = 8;
+
+        while (ip < PAGE_SIZE) {
+                if (8 == bit) {
+                        if (op >= dstmax)
+                                return 0;
+                        ctrl = op++;
+                        dst[ctrl] = 0;
+                        bit = 0;
+                }
+
+                if (ip + ZPOOL_MIN_MATCH <= PAGE_SIZE) {
+                        uint32_t h = hash_zpool(src + ip);
+                        uint32_t cand = zpool_htab[h];
+                        zpool_htab[h] = ip;
+
+                        if ((cand < ip) && (ip - cand <= ZPOOL_MAX_OFFSET)
+                            && (src[cand] == src[ip])
+                            && (src[cand + 1] == src[ip + 1])
+                            && (src[cand + 2] == src[ip + 2])) {
+                                uint32_t len = ZPOOL_MIN_MATCH;
+                                uint32_t off = ip - cand;
+                                while ((len < ZPOOL_MAX_MATCH) && (ip + len < PAGE_SIZE)
+                                       && (src[cand + len] == src[ip + len]))
+                                        len++;
+
+                                if (op + 2 > dstmax)
+                                        return 0;
+                                dst[op++] = (uint8_t)(off >> 4);
+                                dst[op++] = (uint8_t)(((off & 0xf) << 4) | (len - ZPOOL_MIN_MATCH));
+                                dst[ctrl] |= (1 << bit);
+                                ip += len;
+                                bit++;
+                                continue;
+                        }
+                }
+
+                if (op >= dstmax)
+                        return 0;
+                dst[op++] = src[ip++];
+                bit++;
+        }
+        return op;
+}
+
+/*
+ * Expands len bytes of compressed data from src into a full page at dst.
+ * Returns 0 on success, -EINVAL if the data is corrupt.
+ */
+static int
+zpool_decompress(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+        uint32_t ip = 0, op = 0;
+        int bit;
+
+        while ((ip < len) && (op < PAGE_SIZE)) {
+                uint8_t ctrl = src[ip++];
+                for (bit = 0; (bit < 8) && (ip < len) && (op < PAGE_SIZE); ++bit) {
+                        if (ctrl & (1 << bit)) {
+                                uint32_t off, n;
+                                if (ip + 2 > len)
+                                        return -EINVAL;
+                                off = (src[ip] << 4) | (src[ip + 1] >> 4);
+                                n = (src[ip + 1] & 0xf) + ZPOOL_MIN_MATCH;
+                                ip += 2;
+                                if ((0 == off) || (off > op) || (op + n > PAGE_SIZE))
+                                        return -EINVAL;
+                                /* byte by byte, the source may overlap */
+                                for ( ; n > 0; --n, ++op)
+                                        dst[op] = dst[op - off];
+                        } else {
+                                dst[op++] = src[ip++];
+                        }
+                }
+        }
+        return (PAGE_SIZE == op) ? 0 : -EINVAL;
+}
+
+/*
+ * Compresses a page into the pool. Returns a handle to the compressed
+ * data and its length in *lenp, or NULL if the page does not compress
+ * well, the pool is full or there is no memory for it.
+ */
+void *
+zpool_store(const void *page, uint32_t *lenp)
+{
+        uint32_t len;
+        int class;
+        void *zdata;
+
+        len = zpool_compress(page, zpool_buf, ZPOOL_MAX_OBJSIZE);
+        if (0 == len) {
+                zpool_nrejected++;
+                return NULL;
+        }
+
+        class = zpool_class(len);
+        KASSERT(0 <= class);
+        if (zpool_alloc_bytes + zpool_class_size[class] > ZPOOL_MAX_BYTES)
+                return NULL;
+        if (NULL == (zdata = slab_obj_alloc(zpool_allocator[class])))
+                return NULL;
+
+        memcpy(zdata, zpool_buf, len);
+        zpool_nstored++;
+        zpool_comp_bytes += len;
+        zpool_alloc_bytes += zpool_class_size[class];
+
+        *lenp = len;
+        return zdata;
+}
+
+/*
+ * Decompresses a pooled page into page. The pooled copy is left alone.
+ */
+int
+zpool_load(const void *zdata, uint32_t len, void *page)
+{
+        return zpool_decompress(zdata, len, page);
+}
+
+void
+zpool_free(void *zdata, uint32_t len)
+{
+        int class = zpool_class(len);
+        KASSERT(0 <= class);
+
+        slab_obj_free(zpool_allocator[class], zdata);
+        zpool_nstored--;
+        zpool_comp_bytes -= len;
+        zpool_alloc_bytes -= zpool_class_size[class];
+}